@@ -28,6 +28,11 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++*p;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			for_each(&h, v) s += *v;
+			udb_scan_end(s);
+		}
 		udb_measure(n, size(&h), z, &cp[j]);
 	}
 	cleanup(&h);
@@ -31,6 +31,11 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ret.ref->second;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			c_foreach (it, hmap_32, h) s += it.ref->second;
+			udb_scan_end(s);
+		}
 		udb_measure(n, hmap_32_size(&h), z, &cp[j]);
 	}
 	hmap_32_drop(&h);
@@ -1,39 +1,56 @@
+#define UDB_BLOCK_SWEEP
 #include "../common-block.c"
 #include <functional>
 
+#ifdef USE_NODE
+#include <boost/unordered/unordered_node_map.hpp>
+#define BLOCK_MAP boost::unordered_node_map
+#else
 #include <boost/unordered/unordered_flat_map.hpp>
+#define BLOCK_MAP boost::unordered_flat_map
+#endif
 
 struct Hasher {
-	inline size_t operator()(const udb_block_t &x) const {
-		return udb_hash_fn(x);
+	template<class T> inline size_t operator()(const T &x) const {
+		return udb_hash_bytes(x.b, sizeof(x.b));
 	}
 };
 
 struct EqFunc {
-	inline size_t operator()(const udb_block_t &a, const udb_block_t &b) const {
-		return udb_block_eq(a, b);
+	template<class T> inline bool operator()(const T &a, const T &b) const {
+		return memcmp(a.b, b.b, sizeof(a.b)) == 0;
 	}
 };
 
-void test_block(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+template<class Key, class Val>
+void test_block_tpl(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
-	boost::unordered_flat_map<udb_block_t, uint32_t, Hasher, EqFunc> h;
+	BLOCK_MAP<Key, Val, Hasher, EqFunc> h;
 	uint32_t step = (N - n0) / (n_cp - 1);
 	uint32_t i, n, j;
 	uint64_t z = 0, x = x0;
 	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
 		for (; i < n; ++i) {
 			uint64_t y = udb_splitmix64(&x);
-			udb_block_t key;
-			udb_get_key(n, y, &key);
+			Key key;
+			udb_get_key_len(n, y, &key, sizeof(key));
 			if (is_del) {
-				auto p = h.try_emplace(key, i);
+				Val v = {};
+				v.c[0] = i;
+				auto p = h.try_emplace(key, v);
 				if (p.second == false) h.erase(p.first);
 				else ++z;
 			} else {
-				z += ++h[key];
+				z += ++h[key].c[0];
 			}
 		}
 		udb_measure(n, h.size(), z, &cp[j]);
 	}
 }
+
+#define BLOCK_TEST(K, V) \
+	void test_block_##K##_##V(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp) { \
+		test_block_tpl<udb_block##K##_t, udb_val##V##_t>(N, n0, is_del, x0, n_cp, cp); \
+	}
+
+UDB_BLOCK_GRID(BLOCK_TEST)
@@ -1,3 +1,4 @@
+#define UDB_TEST_MT
 #include "../common.c"
 #include <functional>
 
@@ -33,9 +34,52 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++h[low][key];
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t sum = 0;
+			for (uint32_t s = 0; s < KH_SUB_N; ++s)
+				for (const auto &p : h[s]) sum += p.second;
+			udb_scan_end(sum);
+		}
 		uint32_t size = 0;
 		for (uint32_t s = 0; s < KH_SUB_N; ++s)
 			size += h[s].size();
 		udb_measure(n, size, z, &cp[j]);
 	}
 }
+
+typedef boost::unordered_flat_map<uint32_t, uint32_t, Hash32> intmap_t;
+
+static void *worker_int(void *data) // each thread owns a separate ensemble
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	intmap_t *h = (intmap_t*)a->h + a->tid * KH_SUB_N;
+	for (size_t j = 0; j < a->n_key; ++j) { // the keys owned by this thread
+		uint32_t key = a->key[j].key;
+		uint32_t low = udb_hash_fn(key) & KH_SUB_MASK;
+		if (a->is_del) {
+			auto p = h[low].try_emplace(key, a->key[j].i);
+			if (p.second == false) h[low].erase(p.first);
+			else ++a->z;
+		} else {
+			a->z += ++h[low][key];
+		}
+	}
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	intmap_t *h = new intmap_t[n_threads * KH_SUB_N];
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	udb_mtarg_t *a = udb_mt_init(n_threads, is_del, x0, h);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		udb_mt_step(a, i, n, UDB_MT_OWNER, worker_int);
+		uint32_t size = 0;
+		for (int s = 0; s < n_threads * KH_SUB_N; ++s)
+			size += h[s].size();
+		udb_measure(n, size, udb_mt_checksum(a), &cp[j]);
+	}
+	free(a);
+	delete[] h;
+}
@@ -32,6 +32,14 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += cnt;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			GHashTableIter it;
+			gpointer k, v;
+			g_hash_table_iter_init(&it, h);
+			while (g_hash_table_iter_next(&it, &k, &v)) s += GPOINTER_TO_UINT(v);
+			udb_scan_end(s);
+		}
 		udb_measure(n, g_hash_table_size(h), z, &cp[j]);
 	}
 	g_hash_table_destroy(h);
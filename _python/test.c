@@ -31,6 +31,13 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 			}
 			Py_DECREF(k);
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			Py_ssize_t pos = 0;
+			PyObject *k, *v;
+			while (PyDict_Next(h, &pos, &k, &v)) s += PyLong_AsLong(v);
+			udb_scan_end(s);
+		}
 		udb_measure(n, PyDict_Size(h), z, &cp[j]);
 	}
 	Py_DECREF(h);
@@ -0,0 +1,50 @@
+#define UDB_BLOCK_SWEEP
+#include "../common-block.c"
+#include <functional>
+
+#include <unordered_map>
+
+struct Hasher {
+	template<class T> inline size_t operator()(const T &x) const {
+		return udb_hash_bytes(x.b, sizeof(x.b));
+	}
+};
+
+struct EqFunc {
+	template<class T> inline bool operator()(const T &a, const T &b) const {
+		return memcmp(a.b, b.b, sizeof(a.b)) == 0;
+	}
+};
+
+template<class Key, class Val>
+void test_block_tpl(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	std::unordered_map<Key, Val, Hasher, EqFunc> h;
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			Key key;
+			udb_get_key_len(n, y, &key, sizeof(key));
+			if (is_del) {
+				Val v = {};
+				v.c[0] = i;
+				auto p = h.emplace(key, v);
+				if (p.second == false) h.erase(p.first);
+				else ++z;
+			} else {
+				z += ++h[key].c[0];
+			}
+		}
+		udb_measure(n, h.size(), z, &cp[j]);
+	}
+}
+
+#define BLOCK_TEST(K, V) \
+	void test_block_##K##_##V(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp) { \
+		test_block_tpl<udb_block##K##_t, udb_val##V##_t>(N, n0, is_del, x0, n_cp, cp); \
+	}
+
+UDB_BLOCK_GRID(BLOCK_TEST)
@@ -26,6 +26,11 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++h[key];
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			for (const auto &p : h) s += p.second;
+			udb_scan_end(s);
+		}
 		udb_measure(n, h.size(), z, &cp[j]);
 	}
 }
@@ -1,43 +1,31 @@
-#include <stdio.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <string.h>
 #include <assert.h>
-#include <sys/time.h>
-#include <sys/resource.h>
+#include "common-sys.h"
 
-/***********************************
- * Measuring CPU time and peak RSS *
- ***********************************/
+/***************
+ * Checkpoints *
+ ***************/
 
 typedef struct {
 	uint32_t n_input, table_size;
 	uint64_t checksum;
-	double t, mem;
+	double t, rt, mem;
+	uint64_t minflt, pmc[UDB_N_PMC];
+	int64_t heap[3]; // live, peak and spike heap bytes; see udb_heap_read()
+	int64_t rss[3]; // current RSS, anonymous and AnonHugePages bytes; see udb_proc_rss()
 } udb_checkpoint_t;
 
-static double udb_cputime(void)
-{
-	struct rusage r;
-	getrusage(RUSAGE_SELF, &r);
-	return r.ru_utime.tv_sec + r.ru_stime.tv_sec + 1e-6 * (r.ru_utime.tv_usec + r.ru_stime.tv_usec);
-}
-
-static long udb_peakrss(void)
-{
-	struct rusage r;
-	getrusage(RUSAGE_SELF, &r);
-#if defined(__linux__)
-	return r.ru_maxrss * 1024;
-#elif defined(__APPLE__)
-	return r.ru_maxrss;
-#endif
-}
+static double udb_proc_t, udb_proc_rt; // time spent in udb_proc_rss()
 
 static void udb_measure(uint32_t n_input, uint32_t table_size, uint64_t checksum, udb_checkpoint_t *cp)
 {
-	cp->t = udb_cputime();
+	double t, rt;
+	udb_pmc_read(cp->pmc);
+	cp->minflt = udb_minflt();
+	udb_heap_read(cp->heap);
+	t = udb_cputime(), rt = udb_realtime();
+	cp->t = t - udb_proc_t, cp->rt = rt - udb_proc_rt;
+	udb_proc_rss(cp->rss); // smaps_rollup walks the page tables; keep that out of the timing
+	udb_proc_t += udb_cputime() - t, udb_proc_rt += udb_realtime() - rt;
 	cp->mem = udb_peakrss();
 	cp->n_input = n_input;
 	cp->table_size = table_size;
@@ -48,80 +36,217 @@ static void udb_measure(uint32_t n_input, uint32_t table_size, uint64_t checksum
  * Key generation *
  ******************/
 
-uint64_t udb_splitmix64(uint64_t *x)
-{
-	uint64_t z = ((*x) += 0x9e3779b97f4a7c15ULL);
-	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
-	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
-	return z ^ (z >> 31);
-}
-
 #define UDB_BLOCK_N   7
 #define UDB_BLOCK_LEN (UDB_BLOCK_N * 8)
 
-typedef struct {
-	uint8_t b[UDB_BLOCK_LEN];
-} udb_block_t;
+// Key and value sizes in bytes evaluated with -K and -V; X(K,V) is expanded
+// for each pair. Keys are multiples of 8 bytes; values hold a 32-bit count
+// followed by padding.
+#define UDB_BLOCK_GRID(X) \
+	X(8, 4)   X(8, 16)   X(8, 64)   X(8, 256) \
+	X(16, 4)  X(16, 16)  X(16, 64)  X(16, 256) \
+	X(32, 4)  X(32, 16)  X(32, 64)  X(32, 256) \
+	X(56, 4)  X(56, 16)  X(56, 64)  X(56, 256) \
+	X(64, 4)  X(64, 16)  X(64, 64)  X(64, 256) \
+	X(128, 4) X(128, 16) X(128, 64) X(128, 256)
 
-static inline uint64_t udb_hash_fn(const udb_block_t b)
+static inline uint64_t udb_hash_bytes(const uint8_t *b, int len) // FNV-1a
 {
 	uint64_t h = 0xcbf29ce484222325ULL;
 	int i;
-	for (i = 0; i < UDB_BLOCK_LEN; ++i)
-		h ^= b.b[i], h *= 0x100000001B3ULL;
+	for (i = 0; i < len; ++i)
+		h ^= b[i], h *= 0x100000001B3ULL;
 	return h;
 }
 
+#define UDB_KEY_DEF(K) \
+	typedef struct { uint8_t b[K]; } udb_block##K##_t; \
+	static inline uint64_t udb_hash##K(const udb_block##K##_t a) { return udb_hash_bytes(a.b, K); } \
+	static inline int udb_eq##K(const udb_block##K##_t a, const udb_block##K##_t b) { return memcmp(a.b, b.b, K) == 0; }
+
+#define UDB_VAL_DEF(V) \
+	typedef struct { uint32_t c[V/4]; } udb_val##V##_t; // the count is c[0]
+
+UDB_KEY_DEF(8) UDB_KEY_DEF(16) UDB_KEY_DEF(32) UDB_KEY_DEF(56) UDB_KEY_DEF(64) UDB_KEY_DEF(128)
+UDB_VAL_DEF(4) UDB_VAL_DEF(16) UDB_VAL_DEF(64) UDB_VAL_DEF(256)
+
+typedef udb_block56_t udb_block_t;
+
+static inline uint64_t udb_hash_fn(const udb_block_t b)
+{
+	return udb_hash_bytes(b.b, UDB_BLOCK_LEN);
+}
+
 static inline int udb_block_eq(const udb_block_t a, const udb_block_t b)
 {
 	return memcmp(a.b, b.b, UDB_BLOCK_LEN) == 0;
 }
 
-static inline uint64_t udb_get_key(const uint32_t n, const uint64_t y, udb_block_t *b)
+static int udb_key_len = UDB_BLOCK_LEN, udb_val_len = 4; // set by -K and -V
+static const uint8_t *udb_keys = 0; // keys mapped from a file; NULL to generate keys
+static __thread uint32_t udb_key_i = 0; // index of the next key; one cursor per thread
+
+static uint32_t udb_load_keys(const char *fn) // the file consists of udb_key_len-byte records
+{
+	uint32_t n;
+	udb_keys = (const uint8_t*)udb_map_file(fn, udb_key_len, &n);
+	return n;
+}
+
+/***************************************
+ * Precomputed non-uniform key streams *
+ ***************************************/
+
+// Generate the 64-bit seeds of all inputs with the same checkpoint schedule
+// as test_block(), where the n-th input draws from n/4 distinct keys. Each
+// seed is expanded to a block in udb_get_key().
+static const uint64_t *udb_zs = 0;
+
+static uint64_t *udb_gen_keys(const udb_dist_t *d, uint32_t N, uint32_t n0, uint32_t n_cp, uint32_t x0)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t x = x0, *a;
+	a = (uint64_t*)malloc((size_t)N * sizeof(uint64_t));
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		uint32_t m = n>>2 > 0? n>>2 : 1;
+		udb_zipf_t z = {0}; // only set up for zipf; zeroed to keep -Wmaybe-uninitialized quiet
+		if (d->type == UDB_DIST_ZIPF) udb_zipf_init(&z, m, d->s);
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			if (d->type == UDB_DIST_ZIPF) a[i] = (udb_zipf(&z, y) - 1) * 0xd6e8feb86659fd93ULL; // rank 1 is the most frequent
+			else if (d->type == UDB_DIST_SEQ) a[i] = i % m;
+			else if (d->type == UDB_DIST_STRIDE) a[i] = (y % m) * d->k;
+			else if (d->type == UDB_DIST_CLUSTER) a[i] = (y % m / d->k) * 0x9e3779b97f4a7c15ULL + y % m % d->k; // runs of k consecutive integers
+			else a[i] = (y % m) * 0xd6e8feb86659fd93ULL;
+		}
+	}
+	return a;
+}
+
+static inline uint64_t udb_get_key_len(const uint32_t n, const uint64_t y, void *b, const int len) // len is a multiple of 8
 {
 	uint64_t z = (y % (n>>2)) * 0xd6e8feb86659fd93ULL;
 	int i;
-	for (i = 0; i < UDB_BLOCK_LEN; i += 8)
-		memcpy(&b->b[i], &z, 8);
+	if (udb_keys) {
+		memcpy(b, &udb_keys[(size_t)udb_key_i++ * len], len);
+		memcpy(&z, b, 8);
+		return z;
+	}
+	if (udb_zs) z = udb_zs[udb_key_i++];
+	for (i = 0; i < len; i += 8)
+		memcpy((uint8_t*)b + i, &z, 8);
 	return z;
 }
 
+static inline uint64_t udb_get_key(const uint32_t n, const uint64_t y, udb_block_t *b)
+{
+	return udb_get_key_len(n, y, b, UDB_BLOCK_LEN);
+}
+
 /**********************************************
  * For testing key generation time (baseline) *
  **********************************************/
 
+#define UDB_TRAVERSE_DEF(K) \
+	static uint64_t udb_traverse_rng##K(uint32_t n, uint32_t x0) { \
+		uint64_t sum = 0, x = x0; \
+		uint32_t i; \
+		udb_block##K##_t b; \
+		for (i = 0; i < n; ++i) { \
+			uint64_t y = udb_splitmix64(&x); \
+			sum += udb_get_key_len(n, y, &b, K); \
+		} \
+		return sum; \
+	}
+
+UDB_TRAVERSE_DEF(8) UDB_TRAVERSE_DEF(16) UDB_TRAVERSE_DEF(32) UDB_TRAVERSE_DEF(56) UDB_TRAVERSE_DEF(64) UDB_TRAVERSE_DEF(128)
+
 uint64_t udb_traverse_rng(uint32_t n, uint32_t x0)
 {
-	uint64_t sum = 0, x = x0;
-	uint32_t i;
-	udb_block_t b;
-	for (i = 0; i < n; ++i) {
-		uint64_t y = udb_splitmix64(&x);
-		sum += udb_get_key(n, y, &b);
+	udb_key_i = 0;
+	switch (udb_key_len) { // a constant key length, as in the drivers
+		case 8: return udb_traverse_rng8(n, x0);
+		case 16: return udb_traverse_rng16(n, x0);
+		case 32: return udb_traverse_rng32(n, x0);
+		case 64: return udb_traverse_rng64(n, x0);
+		case 128: return udb_traverse_rng128(n, x0);
+		default: return udb_traverse_rng56(n, x0);
 	}
-	return sum;
 }
 
 /*****************
  * Main function *
  *****************/
 
+#ifdef UDB_BLOCK_SWEEP // defined by drivers that implement test_block_K_V() for every pair in UDB_BLOCK_GRID
+#define UDB_BLOCK_DECL(K, V) void test_block_##K##_##V(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp);
+#define UDB_BLOCK_CALL(K, V) if (udb_key_len == K && udb_val_len == V) test_block_##K##_##V(N, n0, is_del, x0, n_cp, cp);
+UDB_BLOCK_GRID(UDB_BLOCK_DECL)
+
+void test_block(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	UDB_BLOCK_GRID(UDB_BLOCK_CALL)
+}
+#else
 void test_block(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp);
+#endif
+
+static int udb_block_valid(int key_len, int val_len)
+{
+#define UDB_BLOCK_VALID(K, V) if (key_len == K && val_len == V) return 1;
+#ifdef UDB_BLOCK_SWEEP
+	UDB_BLOCK_GRID(UDB_BLOCK_VALID)
+#else
+	UDB_BLOCK_VALID(UDB_BLOCK_LEN, 4)
+#endif
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
 	int c;
+	const char *fn_key = 0, *dist_str = "uniform";
+	udb_dist_t dist;
+	uint64_t *gen_keys = 0;
 	double t0, t_keygen;
-	uint64_t sum;
+	uint64_t sum, pmc0[UDB_N_PMC], pmc_keygen[UDB_N_PMC];
 	uint32_t i, n_cp = 11, N = 80000000, n0 = 10000000, x0 = 1, is_del = 0;
+	int use_pmc = 0;
 	udb_checkpoint_t cp0, *cp;
 
-	while ((c = getopt(argc, argv, "n:N:0:k:d")) >= 0) {
+	while ((c = getopt(argc, argv, "n:N:0:k:dei:D:K:V:")) >= 0) {
 		if (c == 'n') n0 = atol(optarg);
 		else if (c == 'N') N = atol(optarg);
 		else if (c == '0') x0 = atol(optarg);
 		else if (c == 'k') n_cp = atoi(optarg);
 		else if (c == 'd') is_del = 1;
+		else if (c == 'e') use_pmc = 1;
+		else if (c == 'i') fn_key = optarg;
+		else if (c == 'D') dist_str = optarg;
+		else if (c == 'K') udb_key_len = atoi(optarg);
+		else if (c == 'V') udb_val_len = atoi(optarg);
+	}
+
+	if (!udb_block_valid(udb_key_len, udb_val_len)) {
+		fprintf(stderr, "ERROR: unsupported key/value sizes %d/%d\n", udb_key_len, udb_val_len);
+		return 1;
+	}
+	if (udb_dist_parse(dist_str, &dist, 0x9e3779b97f4a7c15ULL) < 0) {
+		fprintf(stderr, "ERROR: unknown key distribution '%s'\n", dist_str);
+		return 1;
+	}
+	if (fn_key) { // load keys before any measurement
+		uint32_t n_keys = udb_load_keys(fn_key);
+		if (N > n_keys) {
+			fprintf(stderr, "WARNING: reduced -N to the %u keys in file '%s'\n", n_keys, fn_key);
+			N = n_keys;
+			if (n0 > N) n0 = N;
+		}
+	}
+	if (dist.type != UDB_DIST_UNIFORM) { // precompute keys such that generation is not timed
+		if (fn_key) fprintf(stderr, "WARNING: -D is ignored with -i\n");
+		else udb_zs = gen_keys = udb_gen_keys(&dist, N, n0, n_cp, x0);
 	}
 
 	printf("CL\tUsage: run-test [options]\n");
@@ -130,15 +255,28 @@ int main(int argc, char *argv[])
 	printf("CL\t  -N INT     total number of input items [%d]\n", N);
 	printf("CL\t  -n INT     initial number of input items [%d]\n", n0);
 	printf("CL\t  -k INT     number of checkpoints [%d]\n", n_cp);
+	printf("CL\t  -D STR     key distribution: uniform, zipf[:S], seq, stride[:K] or cluster[:L] [%s]\n", dist_str);
+	printf("CL\t  -K INT     key size in bytes: 8, 16, 32, 56, 64 or 128 [%d]\n", udb_key_len);
+	printf("CL\t  -V INT     value size in bytes: 4, 16, 64 or 256 [%d]\n", udb_val_len);
+	printf("CL\t  -i FILE    read keys from FILE instead of generating them [%s]\n", fn_key? fn_key : "");
+	printf("CL\t  -e         report cycles, instructions, L1D/LLC/dTLB misses per input (Linux only)\n");
 	printf("CL\n");
 
 	cp = (udb_checkpoint_t*)calloc(n_cp, sizeof(*cp));
 
+	if (use_pmc && udb_pmc_init() == 0)
+		fprintf(stderr, "WARNING: failed to open hardware counters\n");
+
+	udb_pmc_read(pmc0);
 	t0 = udb_cputime();
 	sum = udb_traverse_rng(N, x0);
 	t_keygen = udb_cputime() - t0;
+	udb_pmc_read(pmc_keygen);
+	for (i = 0; i < UDB_N_PMC; ++i)
+		pmc_keygen[i] -= pmc0[i];
 	printf("TG\t%.3f\t%ld\n", t_keygen, (long)sum); // need to print sum; otherwise the compiler may optimize udb_traverse_rng() out
 
+	udb_key_i = 0;
 	udb_measure(0, 0, 0, &cp0);
 	test_block(N, n0, is_del, x0, n_cp, cp);
 
@@ -146,9 +284,25 @@ int main(int argc, char *argv[])
 		double t, m;
 		t = (cp[i].t - cp0.t - t_keygen * cp[i].n_input / N) / cp[i].n_input * 1e6;
 		m = (cp[i].mem - cp0.mem) / cp[i].table_size;
-		printf("M%c\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\t%.2f\n", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
+		printf("M%c\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\t%.2f", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
 			cp[i].t - cp0.t, (cp[i].mem - cp0.mem) * 1e-6, t, m);
+		printf("\t%.3f\t%.4f", cp[i].rt - cp0.rt, (double)(cp[i].minflt - cp0.minflt) / cp[i].n_input);
+		if (UDB_HEAP_ON) // live and peak heap above the baseline, and the largest spike, in MB
+			printf("\t%.3f\t%.3f\t%.3f", (cp[i].heap[0] - cp0.heap[0]) * 1e-6, (cp[i].heap[1] - cp0.heap[0]) * 1e-6, cp[i].heap[2] * 1e-6);
+		else printf("\tNA\tNA\tNA");
+		if (cp0.rss[0] > 0) // current RSS in MB and per entry, and anonymous and huge-page memory in MB, above the baseline
+			printf("\t%.3f\t%.2f\t%.3f\t%.3f", (cp[i].rss[0] - cp0.rss[0]) * 1e-6, (double)(cp[i].rss[0] - cp0.rss[0]) / cp[i].table_size,
+				(cp[i].rss[1] - cp0.rss[1]) * 1e-6, (cp[i].rss[2] - cp0.rss[2]) * 1e-6);
+		else printf("\tNA\tNA\tNA\tNA");
+		if (use_pmc) { // per input, excluding key generation
+			int k;
+			for (k = 0; k < UDB_N_PMC; ++k) {
+				if (udb_pmc_fd[k] < 0) printf("\tNA");
+				else printf("\t%.3f", (cp[i].pmc[k] - cp0.pmc[k] - (double)pmc_keygen[k] * cp[i].n_input / N) / cp[i].n_input);
+			}
+		}
+		putchar('\n');
 	}
-	free(cp);
+	free(cp); free(gen_keys);
 	return 0;
 }
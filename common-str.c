@@ -0,0 +1,201 @@
+#include <assert.h>
+#include "common-sys.h"
+
+/***************
+ * Checkpoints *
+ ***************/
+
+typedef struct {
+	uint32_t n_input, table_size;
+	uint64_t checksum;
+	double t, rt, mem;
+	uint64_t minflt, pmc[UDB_N_PMC];
+	int64_t heap[3]; // live, peak and spike heap bytes; see udb_heap_read()
+	int64_t rss[3]; // current RSS, anonymous and AnonHugePages bytes; see udb_proc_rss()
+} udb_checkpoint_t;
+
+static double udb_proc_t, udb_proc_rt; // time spent in udb_proc_rss()
+
+static void udb_measure(uint32_t n_input, uint32_t table_size, uint64_t checksum, udb_checkpoint_t *cp)
+{
+	double t, rt;
+	udb_pmc_read(cp->pmc);
+	cp->minflt = udb_minflt();
+	udb_heap_read(cp->heap);
+	t = udb_cputime(), rt = udb_realtime();
+	cp->t = t - udb_proc_t, cp->rt = rt - udb_proc_rt;
+	udb_proc_rss(cp->rss); // smaps_rollup walks the page tables; keep that out of the timing
+	udb_proc_t += udb_cputime() - t, udb_proc_rt += udb_realtime() - rt;
+	cp->mem = udb_peakrss();
+	cp->n_input = n_input;
+	cp->table_size = table_size;
+	cp->checksum = checksum;
+}
+
+/******************
+ * Key generation *
+ ******************/
+
+static inline uint64_t udb_hash_fn(const char *s) // FNV-1a, as for blocks
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (; *s; ++s)
+		h ^= (uint8_t)*s, h *= 0x100000001B3ULL;
+	return h;
+}
+
+static inline int udb_str_eq(const char *a, const char *b)
+{
+	return strcmp(a, b) == 0;
+}
+
+// All distinct strings are generated before timing and kept in one
+// contiguous pool; string z starts at udb_pool + udb_off[z] and is
+// NUL-terminated. Drivers store pointers into the pool, so the key contents
+// are never copied.
+static char *udb_pool = 0;
+static uint64_t *udb_off = 0;
+
+static uint64_t udb_gen_pool(uint32_t n_str, uint32_t min_len, uint32_t max_len) // return the total length
+{
+	static const char *udb_alphabet = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_";
+	uint64_t tot = 0, x = 11;
+	uint32_t z, i;
+	udb_off = (uint64_t*)malloc(((uint64_t)n_str + 1) * sizeof(uint64_t));
+	for (z = 0; z < n_str; ++z) { // lengths first
+		udb_off[z] = tot;
+		tot += min_len + udb_splitmix64(&x) % (max_len - min_len + 1) + 1;
+	}
+	udb_off[n_str] = tot;
+	udb_pool = (char*)malloc(tot);
+	for (z = 0; z < n_str; ++z) {
+		char *p = &udb_pool[udb_off[z]];
+		uint32_t len = udb_off[z+1] - udb_off[z] - 1;
+		uint64_t r = 0;
+		for (i = 0; i < 6; ++i) // the first six characters encode z in base 64, which makes strings unique
+			p[i] = udb_alphabet[z >> (i * 6) & 0x3f];
+		for (; i < len; ++i) {
+			if ((i & 7) == 6) r = udb_splitmix64(&x);
+			p[i] = udb_alphabet[r & 0x3f], r >>= 8;
+		}
+		p[len] = 0;
+	}
+	return tot - n_str;
+}
+
+static inline const char *udb_get_key(const uint32_t n, const uint64_t y)
+{
+	return &udb_pool[udb_off[y % (n>>2)]];
+}
+
+/**********************************************
+ * For testing key generation time (baseline) *
+ **********************************************/
+
+uint64_t udb_traverse_rng(uint32_t n, uint32_t x0)
+{
+	uint64_t sum = 0, x = x0;
+	uint32_t i;
+	for (i = 0; i < n; ++i) {
+		uint64_t y = udb_splitmix64(&x);
+		sum += (uint8_t)udb_get_key(n, y)[0]; // touch the string, as the table will
+	}
+	return sum;
+}
+
+/*****************
+ * Main function *
+ *****************/
+
+void test_str(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp);
+// UDB_TEST_NO_DEL: defined by drivers whose library cannot delete keys; -d is then rejected
+
+int main(int argc, char *argv[])
+{
+	int c;
+	double t0, t_keygen;
+	uint64_t sum, len, pmc0[UDB_N_PMC], pmc_keygen[UDB_N_PMC];
+	uint32_t i, n_cp = 11, N = 80000000, n0 = 10000000, x0 = 1, is_del = 0, min_len = 8, max_len = 64;
+	int use_pmc = 0;
+	udb_checkpoint_t cp0, *cp;
+
+	while ((c = getopt(argc, argv, "n:N:0:k:deL:")) >= 0) {
+		if (c == 'n') n0 = atol(optarg);
+		else if (c == 'N') N = atol(optarg);
+		else if (c == '0') x0 = atol(optarg);
+		else if (c == 'k') n_cp = atoi(optarg);
+		else if (c == 'd') is_del = 1;
+		else if (c == 'e') use_pmc = 1;
+		else if (c == 'L') {
+			char *p;
+			min_len = max_len = strtol(optarg, &p, 10);
+			if (*p == '-' || *p == ',') max_len = strtol(p + 1, &p, 10);
+		}
+	}
+	if (min_len < 6 || max_len < min_len) {
+		fprintf(stderr, "ERROR: string lengths must satisfy 6 <= MIN <= MAX\n");
+		return 1;
+	}
+#ifdef UDB_TEST_NO_DEL
+	if (is_del) {
+		fprintf(stderr, "ERROR: no deletion implementation for this library\n");
+		return 1;
+	}
+#endif
+
+	printf("CL\tUsage: run-test [options]\n");
+	printf("CL\tOptions:\n");
+	printf("CL\t  -d         evaluate insertion/deletion (insertion only by default)\n");
+	printf("CL\t  -N INT     total number of input items [%d]\n", N);
+	printf("CL\t  -n INT     initial number of input items [%d]\n", n0);
+	printf("CL\t  -k INT     number of checkpoints [%d]\n", n_cp);
+	printf("CL\t  -L MIN-MAX string lengths, uniformly distributed [%d-%d]\n", min_len, max_len);
+	printf("CL\t  -e         report cycles, instructions, L1D/LLC/dTLB misses per input (Linux only)\n");
+	printf("CL\n");
+
+	len = udb_gen_pool(N>>2 > 0? N>>2 : 1, min_len, max_len);
+	printf("TS\t%d\t%.3f\t%.2f\n", N>>2, (len + (N>>2)) * 1e-6, (double)len / (N>>2 > 0? N>>2 : 1)); // #strings, pool size in MB and average length
+
+	cp = (udb_checkpoint_t*)calloc(n_cp, sizeof(*cp));
+
+	if (use_pmc && udb_pmc_init() == 0)
+		fprintf(stderr, "WARNING: failed to open hardware counters\n");
+
+	udb_pmc_read(pmc0);
+	t0 = udb_cputime();
+	sum = udb_traverse_rng(N, x0);
+	t_keygen = udb_cputime() - t0;
+	udb_pmc_read(pmc_keygen);
+	for (i = 0; i < UDB_N_PMC; ++i)
+		pmc_keygen[i] -= pmc0[i];
+	printf("TG\t%.3f\t%ld\n", t_keygen, (long)sum); // need to print sum; otherwise the compiler may optimize udb_traverse_rng() out
+
+	udb_measure(0, 0, 0, &cp0);
+	test_str(N, n0, is_del, x0, n_cp, cp);
+
+	for (i = 0; i < n_cp; ++i) {
+		double t, m;
+		t = (cp[i].t - cp0.t - t_keygen * cp[i].n_input / N) / cp[i].n_input * 1e6;
+		m = (cp[i].mem - cp0.mem) / cp[i].table_size;
+		printf("M%c\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\t%.2f", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
+			cp[i].t - cp0.t, (cp[i].mem - cp0.mem) * 1e-6, t, m);
+		printf("\t%.3f\t%.4f", cp[i].rt - cp0.rt, (double)(cp[i].minflt - cp0.minflt) / cp[i].n_input);
+		if (UDB_HEAP_ON) // live and peak heap above the baseline, and the largest spike, in MB
+			printf("\t%.3f\t%.3f\t%.3f", (cp[i].heap[0] - cp0.heap[0]) * 1e-6, (cp[i].heap[1] - cp0.heap[0]) * 1e-6, cp[i].heap[2] * 1e-6);
+		else printf("\tNA\tNA\tNA");
+		if (cp0.rss[0] > 0) // current RSS in MB and per entry, and anonymous and huge-page memory in MB, above the baseline
+			printf("\t%.3f\t%.2f\t%.3f\t%.3f", (cp[i].rss[0] - cp0.rss[0]) * 1e-6, (double)(cp[i].rss[0] - cp0.rss[0]) / cp[i].table_size,
+				(cp[i].rss[1] - cp0.rss[1]) * 1e-6, (cp[i].rss[2] - cp0.rss[2]) * 1e-6);
+		else printf("\tNA\tNA\tNA\tNA");
+		if (use_pmc) { // per input, excluding key generation
+			int k;
+			for (k = 0; k < UDB_N_PMC; ++k) {
+				if (udb_pmc_fd[k] < 0) printf("\tNA");
+				else printf("\t%.3f", (cp[i].pmc[k] - cp0.pmc[k] - (double)pmc_keygen[k] * cp[i].n_input / N) / cp[i].n_input);
+			}
+		}
+		putchar('\n');
+	}
+	free(cp); free(udb_pool); free(udb_off);
+	return 0;
+}
@@ -0,0 +1,423 @@
+#ifndef UDB_COMMON_SYS_H
+#define UDB_COMMON_SYS_H
+
+/* System probes, heap accounting and key distributions shared by common.c,
+ * common-block.c and common-str.c. Each harness defines its own checkpoint
+ * type, key generator and main(). */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#define udb_unused __attribute__ ((__unused__)) // not every harness uses every helper
+
+/***********************************
+ * Measuring CPU time and peak RSS *
+ ***********************************/
+
+#define UDB_N_PMC 5 // cycles, instructions, L1D misses, LLC misses and dTLB misses
+
+static double udb_cputime(void)
+{
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	return r.ru_utime.tv_sec + r.ru_stime.tv_sec + 1e-6 * (r.ru_utime.tv_usec + r.ru_stime.tv_usec);
+}
+
+static double udb_realtime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static long udb_peakrss(void)
+{
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+#if defined(__linux__)
+	return r.ru_maxrss * 1024;
+#elif defined(__APPLE__)
+	return r.ru_maxrss;
+#endif
+}
+
+static uint64_t udb_minflt(void)
+{
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	return r.ru_minflt;
+}
+
+/* ru_maxrss never goes down; read the current RSS and its anonymous and
+ * transparent-huge-page parts from /proc to see memory returned to the OS */
+static int udb_proc_rss(int64_t *v) // current RSS, Anonymous and AnonHugePages in bytes
+{
+#ifdef __linux__
+	FILE *fp;
+	char buf[256];
+	long long x, y;
+	int n = 0;
+	v[0] = v[1] = v[2] = 0;
+	if ((fp = fopen("/proc/self/statm", "r")) == 0) return 0;
+	if (fscanf(fp, "%lld%lld", &x, &y) == 2) v[0] = y * sysconf(_SC_PAGESIZE), ++n;
+	fclose(fp);
+	if ((fp = fopen("/proc/self/smaps_rollup", "r")) == 0) return n;
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (sscanf(buf, "Anonymous: %lld", &x) == 1) v[1] = x * 1024, ++n;
+		else if (sscanf(buf, "AnonHugePages: %lld", &x) == 1) v[2] = x * 1024, ++n;
+	}
+	fclose(fp);
+	return n;
+#else
+	v[0] = v[1] = v[2] = 0;
+	return 0;
+#endif
+}
+
+/*********************************************************
+ * Live-heap accounting by interposing malloc() on glibc *
+ *********************************************************/
+
+/* udb_peakrss() includes allocator slack and only grows, so it cannot show
+ * what a single rehash costs. On glibc, we replace malloc() and friends with
+ * thin wrappers around __libc_malloc() etc. and track the bytes handed out
+ * (malloc_usable_size()). operator new/delete in libstdc++ call malloc()/free(),
+ * so C++ tables are covered, too; memory mapped directly (kthp.h) is not.
+ *
+ * "spike" is the largest drop in live bytes over a run of consecutive frees
+ * with no allocation in between. Rehashing that allocates a new table before
+ * freeing the old one shows up as a spike of the old table size; in-place
+ * rehashing with realloc() leaves only the size of its working space. A
+ * realloc() is a single step, so a copy inside realloc() is not seen.
+ *
+ * The hooks add malloc_usable_size() and atomics on shared counters to every
+ * allocation, which slows down node-based tables, so they are only compiled
+ * with -DUDB_HEAP, e.g. make CC="gcc -DUDB_HEAP" CXX="g++ -DUDB_HEAP". The
+ * heap columns are NA otherwise.
+ */
+
+typedef struct {
+	int64_t live, peak, hi, spike; // peak and spike since the last checkpoint
+	int falling;
+} udb_heap_t;
+
+static udb_heap_t udb_heap;
+
+static inline void udb_heap_max(int64_t *p, int64_t x)
+{
+	if (x > __atomic_load_n(p, __ATOMIC_RELAXED)) __atomic_store_n(p, x, __ATOMIC_RELAXED); // racy with threads but good enough
+}
+
+static inline void udb_heap_update(int64_t d)
+{
+	int64_t live;
+	if (d > 0) {
+		if (__atomic_load_n(&udb_heap.falling, __ATOMIC_RELAXED)) { // the first allocation after a run of frees
+			__atomic_store_n(&udb_heap.falling, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&udb_heap.hi, __atomic_load_n(&udb_heap.live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		}
+		live = __atomic_add_fetch(&udb_heap.live, d, __ATOMIC_RELAXED);
+		udb_heap_max(&udb_heap.peak, live);
+		udb_heap_max(&udb_heap.hi, live);
+	} else if (d < 0) {
+		live = __atomic_add_fetch(&udb_heap.live, d, __ATOMIC_RELAXED);
+		if (!__atomic_load_n(&udb_heap.falling, __ATOMIC_RELAXED))
+			__atomic_store_n(&udb_heap.falling, 1, __ATOMIC_RELAXED);
+		udb_heap_max(&udb_heap.spike, __atomic_load_n(&udb_heap.hi, __ATOMIC_RELAXED) - live);
+	}
+}
+
+#if defined(__GLIBC__) && defined(UDB_HEAP)
+#include <malloc.h>
+#include <errno.h>
+
+#define UDB_HEAP_ON 1
+
+#ifdef __cplusplus
+#define UDB_THROW __THROW // must match the exception specification in the glibc headers
+extern "C" {
+#else
+#define UDB_THROW
+#endif
+#define UDB_HOOK __attribute__ ((noinline)) // inlined hooks would confuse gcc's builtin knowledge of malloc()
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+UDB_HOOK void *malloc(size_t size) UDB_THROW
+{
+	void *p = __libc_malloc(size);
+	if (p) udb_heap_update(malloc_usable_size(p));
+	return p;
+}
+
+UDB_HOOK void *calloc(size_t n, size_t size) UDB_THROW
+{
+	void *p = __libc_calloc(n, size);
+	if (p) udb_heap_update(malloc_usable_size(p));
+	return p;
+}
+
+UDB_HOOK void *realloc(void *p, size_t size) UDB_THROW
+{
+	int64_t old = p? malloc_usable_size(p) : 0;
+	void *q = __libc_realloc(p, size);
+	if (q) udb_heap_update((int64_t)malloc_usable_size(q) - old);
+	else if (size == 0) udb_heap_update(-old); // realloc(p, 0) frees p
+	return q;
+}
+
+UDB_HOOK void free(void *p) UDB_THROW
+{
+	if (p == 0) return;
+	udb_heap_update(-(int64_t)malloc_usable_size(p));
+	__libc_free(p);
+}
+
+UDB_HOOK void *memalign(size_t align, size_t size) UDB_THROW
+{
+	void *p = __libc_memalign(align, size);
+	if (p) udb_heap_update(malloc_usable_size(p));
+	return p;
+}
+
+UDB_HOOK void *aligned_alloc(size_t align, size_t size) UDB_THROW { return memalign(align, size); }
+UDB_HOOK void *valloc(size_t size) UDB_THROW { return memalign(sysconf(_SC_PAGESIZE), size); }
+
+UDB_HOOK void *pvalloc(size_t size) UDB_THROW // blocks from pvalloc() are released by free(), so count them, too
+{
+	size_t pg = sysconf(_SC_PAGESIZE);
+	return memalign(pg, size? (size + pg - 1) / pg * pg : pg);
+}
+
+UDB_HOOK int posix_memalign(void **p, size_t align, size_t size) UDB_THROW
+{
+	if (align < sizeof(void*) || (align & (align - 1))) return EINVAL;
+	*p = memalign(align, size);
+	return *p? 0 : ENOMEM;
+}
+#ifdef __cplusplus
+}
+#endif
+#else
+#define UDB_HEAP_ON 0
+#endif
+
+static void udb_heap_read(int64_t *v) // live, peak and spike since the last call
+{
+	v[0] = __atomic_load_n(&udb_heap.live, __ATOMIC_RELAXED);
+	v[1] = __atomic_load_n(&udb_heap.peak, __ATOMIC_RELAXED);
+	v[2] = __atomic_load_n(&udb_heap.spike, __ATOMIC_RELAXED);
+	__atomic_store_n(&udb_heap.peak, v[0], __ATOMIC_RELAXED);
+	__atomic_store_n(&udb_heap.spike, 0, __ATOMIC_RELAXED);
+}
+
+/***************************************************
+ * Hardware counters with perf_event_open on Linux *
+ ***************************************************/
+
+static int udb_pmc_fd[UDB_N_PMC] = { -1, -1, -1, -1, -1 };
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+static int udb_pmc_open1(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr pe;
+	int fd;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = type, pe.size = sizeof(pe), pe.config = config;
+	pe.inherit = 1, pe.exclude_hv = 1; // inherit: count threads created later
+	fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+	if (fd < 0) { // not allowed to count the kernel when perf_event_paranoid >= 2
+		pe.exclude_kernel = 1;
+		fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+	}
+	return fd;
+}
+
+static int udb_pmc_init(void)
+{
+	int i, n = 0;
+	udb_pmc_fd[0] = udb_pmc_open1(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	udb_pmc_fd[1] = udb_pmc_open1(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	udb_pmc_fd[2] = udb_pmc_open1(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ<<8 | PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+	udb_pmc_fd[3] = udb_pmc_open1(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	udb_pmc_fd[4] = udb_pmc_open1(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ<<8 | PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+	for (i = 0; i < UDB_N_PMC; ++i)
+		if (udb_pmc_fd[i] >= 0) ++n;
+	return n;
+}
+
+static void udb_pmc_read(uint64_t *v)
+{
+	int i;
+	for (i = 0; i < UDB_N_PMC; ++i)
+		if (udb_pmc_fd[i] < 0 || read(udb_pmc_fd[i], &v[i], 8) != 8)
+			v[i] = 0;
+}
+#else
+static int udb_pmc_init(void) { return 0; }
+static void udb_pmc_read(uint64_t *v) { memset(v, 0, UDB_N_PMC * sizeof(uint64_t)); }
+#endif
+
+/***************************
+ * Keys mapped from a file *
+ ***************************/
+
+static udb_unused const void *udb_map_file(const char *fn, size_t rec_len, uint32_t *n_rec) // the file consists of rec_len-byte records
+{
+	struct stat st;
+	size_t len;
+	int fd, flag = MAP_PRIVATE;
+	void *p;
+	if ((fd = open(fn, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "ERROR: failed to open file '%s'\n", fn);
+		exit(1);
+	}
+	len = st.st_size / rec_len * rec_len;
+	if (len == 0) {
+		fprintf(stderr, "ERROR: no keys in file '%s'\n", fn);
+		exit(1);
+	}
+#ifdef MAP_POPULATE
+	flag |= MAP_POPULATE; // read the whole file now, not in the timed region
+#endif
+	p = mmap(0, len, PROT_READ, flag, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "ERROR: failed to mmap file '%s'\n", fn);
+		exit(1);
+	}
+	madvise(p, len, MADV_SEQUENTIAL);
+	*n_rec = len / rec_len > UINT32_MAX? UINT32_MAX : len / rec_len;
+	return p;
+}
+
+/*****************************************
+ * Random numbers and key distributions *
+ *****************************************/
+
+uint64_t udb_splitmix64(uint64_t *x)
+{
+	uint64_t z = ((*x) += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// log() and exp() without libm, which the Makefiles don't link
+static udb_unused double udb_log(double x) // x > 0
+{
+	const double ln2 = 0.69314718055994530942;
+	union { double d; uint64_t u; } v;
+	double z, z2, s = 0.0, t;
+	int e, k;
+	v.d = x;
+	e = (int)(v.u >> 52 & 0x7ff) - 1023;
+	v.u = (v.u & 0xfffffffffffffULL) | 0x3ff0000000000000ULL; // mantissa in [1,2)
+	if (v.d > 1.41421356237309504880) v.d *= 0.5, ++e;
+	z = (v.d - 1.0) / (v.d + 1.0), z2 = z * z;
+	for (k = 21, t = 0.0; k >= 1; k -= 2) // log(m) = 2*atanh(z) = 2*(z + z^3/3 + ...)
+		t = t * z2 + 1.0 / k;
+	s = 2.0 * z * t;
+	return e * ln2 + s;
+}
+
+static udb_unused double udb_exp(double x)
+{
+	const double ln2 = 0.69314718055994530942;
+	union { double d; uint64_t u; } v;
+	double r, t = 1.0;
+	int k, i;
+	if (x < -708.0) return 0.0;
+	if (x > 709.0) x = 709.0;
+	k = (int)(x / ln2 + (x < 0? -0.5 : 0.5));
+	r = x - k * ln2;
+	for (i = 15; i >= 1; --i) // Taylor series on |r| <= ln2/2
+		t = 1.0 + t * r / i;
+	v.u = (uint64_t)(k + 1023) << 52;
+	return t * v.d;
+}
+
+static udb_unused double udb_log1p_x(double x) { return x > 1e-4 || x < -1e-4? udb_log(1.0 + x) / x : 1.0 - x * (0.5 - x * (1.0 / 3 - 0.25 * x)); } // log(1+x)/x
+static udb_unused double udb_expm1_x(double x) { return x > 1e-4 || x < -1e-4? (udb_exp(x) - 1.0) / x : 1.0 + x * 0.5 * (1.0 + x / 3 * (1.0 + 0.25 * x)); } // (exp(x)-1)/x
+
+typedef struct { // Zipf on [1,n] by rejection-inversion (Hormann and Derflinger, 1996)
+	double s, h_x1, h_n, t;
+	uint32_t n;
+} udb_zipf_t;
+
+static udb_unused double udb_zipf_h(const udb_zipf_t *z, double x) { return udb_exp(-z->s * udb_log(x)); }
+static udb_unused double udb_zipf_hi(const udb_zipf_t *z, double x) { double lx = udb_log(x); return udb_expm1_x((1.0 - z->s) * lx) * lx; }
+static udb_unused double udb_zipf_hi_inv(const udb_zipf_t *z, double x)
+{
+	double t = x * (1.0 - z->s);
+	if (t < -1.0) t = -1.0;
+	return udb_exp(udb_log1p_x(t) * x);
+}
+
+static udb_unused void udb_zipf_init(udb_zipf_t *z, uint32_t n, double s)
+{
+	z->n = n, z->s = s;
+	z->h_x1 = udb_zipf_hi(z, 1.5) - 1.0;
+	z->h_n = udb_zipf_hi(z, n + 0.5);
+	z->t = 2.0 - udb_zipf_hi_inv(z, udb_zipf_hi(z, 2.5) - udb_zipf_h(z, 2.0));
+}
+
+static udb_unused uint32_t udb_zipf(const udb_zipf_t *z, uint64_t y) // y seeds the uniform draws
+{
+	while (1) {
+		double u = z->h_n + (udb_splitmix64(&y) >> 11) * (1.0 / 9007199254740992.0) * (z->h_x1 - z->h_n);
+		double x = udb_zipf_hi_inv(z, u);
+		double k = (double)(uint32_t)(x + 0.5);
+		if (k < 1.0) k = 1.0;
+		else if (k > z->n) k = z->n;
+		if (k - x <= z->t || u >= udb_zipf_hi(z, k + 0.5) - udb_zipf_h(z, k))
+			return (uint32_t)k;
+	}
+}
+
+enum { UDB_DIST_UNIFORM, UDB_DIST_ZIPF, UDB_DIST_SEQ, UDB_DIST_STRIDE, UDB_DIST_CLUSTER };
+
+typedef struct {
+	int type;
+	double s;   // Zipf exponent
+	uint64_t k; // stride or cluster length
+} udb_dist_t;
+
+// fib: the multiplier of the Fibonacci hashing that the default stride defeats
+static udb_unused int udb_dist_parse(const char *str, udb_dist_t *d, uint64_t fib)
+{
+	const char *p = strchr(str, ':');
+	size_t l = p? (size_t)(p - str) : strlen(str);
+	d->s = 1.0, d->k = 0;
+	if (l == 7 && strncmp(str, "uniform", l) == 0) d->type = UDB_DIST_UNIFORM;
+	else if (l == 4 && strncmp(str, "zipf", l) == 0) d->type = UDB_DIST_ZIPF, d->s = p? atof(p + 1) : 0.99;
+	else if (l == 3 && strncmp(str, "seq", l) == 0) d->type = UDB_DIST_SEQ;
+	else if (l == 6 && strncmp(str, "stride", l) == 0) d->type = UDB_DIST_STRIDE, d->k = p? strtoull(p + 1, 0, 0) : 0;
+	else if (l == 7 && strncmp(str, "cluster", l) == 0) d->type = UDB_DIST_CLUSTER, d->k = p? strtoull(p + 1, 0, 0) : 64;
+	else return -1;
+	if (d->type == UDB_DIST_STRIDE && d->k == 0) { // the inverse of fib mod 2^64, so that k*i*fib == i; worst for Fibonacci hashing with the identity hash
+		uint64_t x = fib;
+		int i;
+		for (i = 0; i < 6; ++i) x *= 2 - fib * x; // Newton's iteration
+		d->k = x;
+	}
+	if (d->type == UDB_DIST_CLUSTER && d->k == 0) d->k = 1;
+	return d->type == UDB_DIST_ZIPF && d->s <= 0.0? -1 : 0;
+}
+
+#endif
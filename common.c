@@ -1,42 +1,195 @@
-#include <stdio.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <stdint.h>
 #include <assert.h>
-#include <sys/time.h>
-#include <sys/resource.h>
+#include "common-sys.h"
 
-/***********************************
- * Measuring CPU time and peak RSS *
- ***********************************/
+/***************
+ * Checkpoints *
+ ***************/
 
 typedef struct {
 	uint32_t n_input, table_size;
 	uint64_t checksum;
-	double t, mem;
+	double t, rt, mem;
+	uint64_t minflt, pmc[UDB_N_PMC];
+	int64_t heap[3]; // live, peak and spike heap bytes; see udb_heap_read()
+	int64_t rss[3]; // current RSS, anonymous and AnonHugePages bytes; see udb_proc_rss()
+	uint64_t lat_n, lat_q[4]; // #samples; p50, p99, p99.9 and max latency in ticks since the previous checkpoint
+	uint32_t lat_rh_st, lat_rh_en; // samples that triggered a rehash, in udb_lat.rh[]
+	uint64_t mix_n[4], mix_t[4]; // #operations and ticks per operation type in the mixed workload
+	double scan_t; // CPU time spent on full-table scans so far
+	uint64_t scan_sum; // sum of values from the last scan
+	uint32_t scan_n; // number of scans so far
 } udb_checkpoint_t;
 
-static double udb_cputime(void)
+/***********************************
+ * Sampled per-operation latencies *
+ ***********************************/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t udb_rdtsc(void)
 {
-	struct rusage r;
-	getrusage(RUSAGE_SELF, &r);
-	return r.ru_utime.tv_sec + r.ru_stime.tv_sec + 1e-6 * (r.ru_utime.tv_usec + r.ru_stime.tv_usec);
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t t;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
 
-static long udb_peakrss(void)
+static inline uint64_t udb_rdtsc_fenced(void) // wait for earlier instructions to complete; for attributing time to individual operations
 {
-	struct rusage r;
-	getrusage(RUSAGE_SELF, &r);
-#if defined(__linux__)
-	return r.ru_maxrss * 1024;
-#elif defined(__APPLE__)
-	return r.ru_maxrss;
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t t;
+	_mm_lfence();
+	t = __rdtsc();
+	_mm_lfence();
+	return t;
+#elif defined(__aarch64__)
+	__asm__ __volatile__("isb" ::: "memory");
+	return udb_rdtsc();
+#else
+	return udb_rdtsc();
 #endif
 }
 
+#define UDB_LAT_SUB 4 // 16 sub-buckets per power of 2, or a relative error of 1/16 like HdrHistogram
+#define UDB_LAT_N   ((64 - UDB_LAT_SUB + 1) << UDB_LAT_SUB)
+
+typedef struct {
+	uint32_t k, left;  // sample every k-th operation; operations left before the next sample
+	uint64_t t0;       // start of the current sampled operation; 0 if not sampled
+	uint64_t n, cnt[UDB_LAT_N];
+	uint32_t n_rh, m_rh;
+	uint64_t *rh;      // latencies of samples that triggered a rehash
+} udb_lat_t;
+
+static udb_lat_t udb_lat;
+
+static inline uint32_t udb_lat_bin(uint64_t x)
+{
+	int e;
+	if (x < 1U<<UDB_LAT_SUB) return x;
+	e = 63 - __builtin_clzll(x);
+	return (uint32_t)(e - UDB_LAT_SUB + 1) << UDB_LAT_SUB | (x >> (e - UDB_LAT_SUB) & ((1U<<UDB_LAT_SUB) - 1));
+}
+
+static inline uint64_t udb_lat_bin_max(uint32_t b) // the largest value in bin b
+{
+	uint32_t e = b >> UDB_LAT_SUB, m = b & ((1U<<UDB_LAT_SUB) - 1);
+	if (e == 0) return m;
+	return (((uint64_t)(1U<<UDB_LAT_SUB | m) + 1) << (e - 1)) - 1;
+}
+
+static inline void udb_lat_begin(void) // call before an operation
+{
+	if (udb_lat.k && --udb_lat.left == 0)
+		udb_lat.left = udb_lat.k, udb_lat.t0 = udb_rdtsc();
+}
+
+static inline void udb_lat_end(int rehashed) // call after the operation; rehashed: whether the table was resized
+{
+	if (udb_lat.t0) {
+		uint64_t d = udb_rdtsc() - udb_lat.t0;
+		++udb_lat.cnt[udb_lat_bin(d)], ++udb_lat.n;
+		if (rehashed) {
+			if (udb_lat.n_rh == udb_lat.m_rh) {
+				udb_lat.m_rh += (udb_lat.m_rh>>1) + 16;
+				udb_lat.rh = (uint64_t*)realloc(udb_lat.rh, udb_lat.m_rh * sizeof(uint64_t));
+			}
+			udb_lat.rh[udb_lat.n_rh++] = d;
+		}
+		udb_lat.t0 = 0;
+	}
+}
+
+static void udb_lat_collect(udb_checkpoint_t *cp) // summarize and reset the histogram
+{
+	static const double q[3] = { .5, .99, .999 };
+	static uint32_t rh_st = 0;
+	uint64_t acc = 0;
+	uint32_t b, j = 0;
+	cp->lat_n = udb_lat.n;
+	memset(cp->lat_q, 0, sizeof(cp->lat_q));
+	for (b = 0; b < UDB_LAT_N; ++b) {
+		if (udb_lat.cnt[b] == 0) continue;
+		acc += udb_lat.cnt[b];
+		for (; j < 3 && acc >= q[j] * udb_lat.n; ++j)
+			cp->lat_q[j] = udb_lat_bin_max(b);
+		cp->lat_q[3] = udb_lat_bin_max(b);
+	}
+	cp->lat_rh_st = rh_st, cp->lat_rh_en = rh_st = udb_lat.n_rh;
+	memset(udb_lat.cnt, 0, sizeof(udb_lat.cnt));
+	udb_lat.n = 0;
+}
+
+static double udb_lat_calibrate(void) // ticks per nanosecond
+{
+	double t0 = udb_realtime(), t;
+	uint64_t c0 = udb_rdtsc();
+	while ((t = udb_realtime()) - t0 < 0.02);
+	return (udb_rdtsc() - c0) / (t - t0) * 1e-9;
+}
+
+static void udb_mix_collect(udb_checkpoint_t *cp);
+
+/*
+ * With -s, drivers scan the whole table right before each udb_measure():
+ *
+ *   if (udb_scan_begin()) {
+ *     uint64_t s = 0;
+ *     kh_foreach(h, k) s += kh_val(h, k);
+ *     udb_scan_end(s);
+ *   }
+ *
+ * Scan time is reported separately and excluded from the main timing. A
+ * checkpoint without a scan is reported as NA.
+ */
+typedef struct {
+	int on;
+	uint32_t n;
+	double t0, t;
+	uint64_t sum;
+} udb_scan_t;
+
+static udb_scan_t udb_scan;
+
+static inline int udb_scan_begin(void)
+{
+	if (udb_scan.on) udb_scan.t0 = udb_cputime();
+	return udb_scan.on;
+}
+
+static inline void udb_scan_end(uint64_t sum)
+{
+	udb_scan.t += udb_cputime() - udb_scan.t0;
+	udb_scan.sum = sum;
+	++udb_scan.n;
+}
+
+static double udb_untimed_t, udb_untimed_rt; // excluded from the measurement: key generation in udb_mt_step() and udb_proc_rss()
+
 static void udb_measure(uint32_t n_input, uint32_t table_size, uint64_t checksum, udb_checkpoint_t *cp)
 {
-	cp->t = udb_cputime();
+	double t, rt;
+	udb_lat_collect(cp);
+	udb_mix_collect(cp);
+	cp->scan_t = udb_scan.t;
+	cp->scan_sum = udb_scan.sum;
+	cp->scan_n = udb_scan.n;
+	udb_pmc_read(cp->pmc);
+	cp->minflt = udb_minflt();
+	udb_heap_read(cp->heap);
+	t = udb_cputime(), rt = udb_realtime();
+	cp->t = t - udb_untimed_t, cp->rt = rt - udb_untimed_rt;
+	udb_proc_rss(cp->rss); // smaps_rollup walks the page tables; keep that out of the timing
+	udb_untimed_t += udb_cputime() - t, udb_untimed_rt += udb_realtime() - rt;
 	cp->mem = udb_peakrss();
 	cp->n_input = n_input;
 	cp->table_size = table_size;
@@ -47,14 +200,6 @@ static void udb_measure(uint32_t n_input, uint32_t table_size, uint64_t checksum
  * Key generation *
  ******************/
 
-uint64_t udb_splitmix64(uint64_t *x)
-{
-	uint64_t z = ((*x) += 0x9e3779b97f4a7c15ULL);
-	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
-	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
-	return z ^ (z >> 31);
-}
-
 static inline uint64_t udb_hash_fn(uint32_t z)
 {
 	uint64_t x = z;
@@ -66,11 +211,57 @@ static inline uint64_t udb_hash_fn(uint32_t z)
 	return x;
 }
 
+static const uint32_t *udb_keys = 0; // keys mapped from a file; NULL to generate keys
+static __thread uint32_t udb_key_i = 0; // index of the next key; one cursor per thread
+
+static uint32_t udb_load_keys(const char *fn) // the file consists of 32-bit keys in the native byte order
+{
+	uint32_t n;
+	udb_keys = (const uint32_t*)udb_map_file(fn, sizeof(uint32_t), &n);
+	return n;
+}
+
 static inline uint32_t udb_get_key(const uint32_t n, const uint64_t y)
 {
+	if (udb_keys) return udb_keys[udb_key_i++];
 	return (uint32_t)(y % (n>>2)) * 0x45D9F3B;
 }
 
+static inline uint64_t udb_seek(uint32_t x0, uint32_t i) // state of the splitmix64 stream after i draws; also seeks the key file
+{
+	udb_key_i = i;
+	return x0 + (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+}
+
+/***************************************
+ * Precomputed non-uniform key streams *
+ ***************************************/
+
+// Generate the keys of all inputs with the same checkpoint schedule as
+// test_int(), where the n-th input draws from n/4 distinct keys. Keys are
+// scrambled ranks unless the shape itself is what is being tested.
+static uint32_t *udb_gen_keys(const udb_dist_t *d, uint32_t N, uint32_t n0, uint32_t n_cp, uint32_t x0)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j, *a;
+	uint64_t x = x0;
+	a = (uint32_t*)malloc((size_t)N * sizeof(uint32_t));
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		uint32_t m = n>>2 > 0? n>>2 : 1;
+		udb_zipf_t z = {0}; // only set up for zipf; zeroed to keep -Wmaybe-uninitialized quiet
+		if (d->type == UDB_DIST_ZIPF) udb_zipf_init(&z, m, d->s);
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			if (d->type == UDB_DIST_ZIPF) a[i] = (udb_zipf(&z, y) - 1) * 0x45D9F3B; // rank 1 is the most frequent
+			else if (d->type == UDB_DIST_SEQ) a[i] = i % m;
+			else if (d->type == UDB_DIST_STRIDE) a[i] = (uint32_t)(y % m) * d->k;
+			else if (d->type == UDB_DIST_CLUSTER) a[i] = (uint32_t)(y % m / d->k) * 0x9E3779B1U + (uint32_t)(y % m % d->k); // runs of k consecutive integers
+			else a[i] = (uint32_t)(y % m) * 0x45D9F3B;
+		}
+	}
+	return a;
+}
+
 /**********************************************
  * For testing key generation time (baseline) *
  **********************************************/
@@ -79,6 +270,7 @@ uint64_t udb_traverse_rng(uint32_t n, uint32_t x0)
 {
 	uint64_t sum = 0, x = x0;
 	uint32_t i;
+	udb_key_i = 0;
 	for (i = 0; i < n; ++i) {
 		uint64_t y = udb_splitmix64(&x);
 		sum += udb_get_key(n, y);
@@ -86,26 +278,460 @@ uint64_t udb_traverse_rng(uint32_t n, uint32_t x0)
 	return sum;
 }
 
+/*************************
+ * Lookup-heavy workload *
+ *************************/
+
+// The table is built from N distinct keys udb_build_key(0..N-1). A lookup key
+// is present with probability hit/2^32; a missing key maps an index >=N with
+// the same bijection, so it is never in the table.
+static inline uint32_t udb_build_key(uint32_t i)
+{
+	return i * 0x45D9F3B;
+}
+
+static inline uint32_t udb_lookup_key(uint32_t n, uint64_t hit, uint64_t y)
+{
+	uint32_t r = y >> 32;
+	if ((y & 0xffffffffU) < hit) return udb_build_key(r % n);
+	return udb_build_key(n + r % (uint32_t)(0x100000000ULL - n));
+}
+
+uint64_t udb_traverse_lookup(uint32_t n, uint32_t n_q, uint64_t hit, uint32_t x0)
+{
+	uint64_t sum = 0, x = x0;
+	uint32_t i;
+	for (i = 0; i < n_q; ++i)
+		sum += udb_lookup_key(n, hit, udb_splitmix64(&x));
+	return sum;
+}
+
+/******************
+ * Range workload *
+ ******************/
+
+// An ordered index is loaded from the N keys udb_build_key(0..N-1) in sorted
+// order. Each range query starts at the first key >= udb_range_key() and
+// visits up to len keys in order.
+#ifdef UDB_TEST_RANGE
+static int udb_cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t *udb_sorted_keys(uint32_t n)
+{
+	uint32_t i, *a = (uint32_t*)malloc(n * sizeof(uint32_t));
+	for (i = 0; i < n; ++i) a[i] = udb_build_key(i);
+	qsort(a, n, sizeof(uint32_t), udb_cmp_u32);
+	return a;
+}
+#endif
+
+static inline uint32_t udb_range_key(uint64_t *x)
+{
+	return udb_splitmix64(x) >> 32;
+}
+
+/******************
+ * Mixed workload *
+ ******************/
+
+// A YCSB-like mix: read and update an existing value, insert a new key, and
+// delete. Read, update and delete draw a key uniformly from all keys inserted
+// so far, deleted or not; inserts always add a new key. Each operation is
+// decided by one splitmix64 draw, so every library sees the same sequence.
+enum { UDB_MIX_READ, UDB_MIX_UPDATE, UDB_MIX_INSERT, UDB_MIX_DELETE };
+
+typedef struct {
+	uint64_t thres[3]; // cumulative fractions of read, update and insert in 1/2^32
+	uint32_t n_ins; // number of keys inserted so far
+	uint64_t t0, n[4], t[4];
+} udb_mix_t;
+
+static udb_mix_t udb_mix;
+
+static int udb_mix_parse(const char *str, udb_mix_t *m) // e.g. "r=80,u=10,i=5,d=5"
+{
+	double f[4] = {0, 0, 0, 0}, sum = 0.0, cum = 0.0;
+	const char *p = str;
+	int c;
+	while (*p) {
+		char *q;
+		const char *t = strchr("ruid", *p);
+		if (t == 0 || *t == 0 || p[1] != '=') return -1;
+		f[t - "ruid"] = strtod(p + 2, &q);
+		if (q == p + 2 || f[t - "ruid"] < 0.0) return -1;
+		p = *q == ','? q + 1 : q;
+		if (*q && *q != ',') return -1;
+	}
+	for (c = 0; c < 4; ++c) sum += f[c];
+	if (sum <= 0.0) return -1;
+	for (c = 0; c < 3; ++c) {
+		cum += f[c];
+		m->thres[c] = (uint64_t)(cum / sum * 4294967296.0);
+	}
+	return 0;
+}
+
+static inline int udb_mix_next(uint64_t y, uint32_t *key) // pick the operation and its key; start timing
+{
+	uint32_t r = (uint32_t)y;
+	int c;
+	for (c = 0; c < 3 && r >= udb_mix.thres[c]; ++c);
+	if (c == UDB_MIX_INSERT) *key = udb_build_key(udb_mix.n_ins++);
+	else *key = udb_build_key(udb_mix.n_ins? (y >> 32) % udb_mix.n_ins : 0);
+	udb_mix.t0 = udb_rdtsc_fenced();
+	return c;
+}
+
+static inline void udb_mix_end(int c) // call after the operation returned by udb_mix_next()
+{
+	udb_mix.t[c] += udb_rdtsc_fenced() - udb_mix.t0;
+	++udb_mix.n[c];
+}
+
+static void udb_mix_collect(udb_checkpoint_t *cp)
+{
+	memcpy(cp->mix_n, udb_mix.n, sizeof(cp->mix_n));
+	memcpy(cp->mix_t, udb_mix.t, sizeof(cp->mix_t));
+}
+
+uint64_t udb_traverse_mix(uint32_t N, uint32_t x0) // baseline: key generation and timer overhead
+{
+	uint64_t sum = 0, x = x0;
+	uint32_t i, key;
+	for (i = 0; i < N; ++i) {
+		int c = udb_mix_next(udb_splitmix64(&x), &key);
+		sum += key;
+		udb_mix_end(c);
+	}
+	return sum;
+}
+
+/*******************************
+ * Multi-threaded benchmarking *
+ *******************************/
+
+#ifdef UDB_TEST_MT
+#include <pthread.h>
+
+#define UDB_MT_NOKEY 0 // workers do not read the inputs
+#define UDB_MT_SLICE 1 // thread t takes inputs [st,en)
+#define UDB_MT_OWNER 2 // thread t takes the inputs whose key it owns by udb_mt_owner()
+
+typedef struct {
+	uint32_t key, i; // key and its input index
+} udb_mtkey_t;
+
+typedef struct {
+	int tid, n_threads;
+	int32_t is_del;
+	uint32_t x0;       // seed shared by all threads
+	uint32_t i0, n;    // inputs [i0,n) are processed at the current checkpoint
+	uint32_t st, en;   // this thread's slice of the inputs
+	size_t n_key, m_key;
+	udb_mtkey_t *key;  // inputs taken by this thread, in input order; generated by udb_mt_step()
+	void *h;           // the shared table, or an array of per-thread tables
+	uint64_t z;        // per-thread checksum
+	int64_t cnt;       // per-thread change to the table size, if the table does not track it
+} udb_mtarg_t;
+
+static inline int udb_mt_owner(uint32_t key, int n_threads) // for per-thread tables; independent of the low hash bits
+{
+	return (int)((udb_hash_fn(key) >> 32) * n_threads >> 32);
+}
+
+udb_mtarg_t *udb_mt_init(int n_threads, int32_t is_del, uint32_t x0, void *h)
+{
+	udb_mtarg_t *a;
+	int t;
+	a = (udb_mtarg_t*)calloc(n_threads, sizeof(*a));
+	for (t = 0; t < n_threads; ++t)
+		a[t].tid = t, a[t].n_threads = n_threads, a[t].is_del = is_del, a[t].x0 = x0, a[t].h = h;
+	return a;
+}
+
+static void udb_mt_keys(udb_mtarg_t *a, int mode) // distribute inputs [i0,n) to the threads
+{
+	uint64_t x = udb_seek(a[0].x0, a[0].i0);
+	uint32_t i;
+	int t = 0;
+	for (i = a[0].i0; i < a[0].n; ++i) {
+		uint64_t y = udb_splitmix64(&x);
+		uint32_t key = udb_get_key(a[0].n, y);
+		udb_mtarg_t *b;
+		if (mode == UDB_MT_OWNER) b = &a[udb_mt_owner(key, a[0].n_threads)];
+		else { while (i >= a[t].en) ++t; b = &a[t]; }
+		if (b->n_key == b->m_key) {
+			b->m_key += (b->m_key>>1) + 16;
+			b->key = (udb_mtkey_t*)realloc(b->key, b->m_key * sizeof(udb_mtkey_t));
+		}
+		b->key[b->n_key].key = key, b->key[b->n_key++].i = i;
+	}
+}
+
+/* Process inputs [i0,n) with all threads. Keys are generated in one thread
+ * before the workers start and this time is excluded from the measurement;
+ * otherwise per-thread tables would make every thread generate all keys. The
+ * key buffers are freed before returning, so udb_measure() does not see them. */
+void udb_mt_step(udb_mtarg_t *a, uint32_t i0, uint32_t n, int mode, void *(*func)(void*))
+{
+	int t, n_threads = a[0].n_threads;
+	double t0 = udb_cputime(), rt0 = udb_realtime();
+	pthread_t *tid;
+	tid = (pthread_t*)calloc(n_threads, sizeof(*tid));
+	for (t = 0; t < n_threads; ++t) {
+		a[t].i0 = i0, a[t].n = n;
+		a[t].st = i0 + (uint64_t)(n - i0) * t / n_threads;
+		a[t].en = i0 + (uint64_t)(n - i0) * (t + 1) / n_threads;
+		a[t].n_key = 0;
+	}
+	if (mode != UDB_MT_NOKEY) udb_mt_keys(a, mode);
+	udb_untimed_t += udb_cputime() - t0, udb_untimed_rt += udb_realtime() - rt0;
+	for (t = 0; t < n_threads; ++t)
+		pthread_create(&tid[t], 0, func, &a[t]);
+	for (t = 0; t < n_threads; ++t)
+		pthread_join(tid[t], 0);
+	for (t = 0; t < n_threads; ++t) {
+		free(a[t].key);
+		a[t].key = 0, a[t].n_key = a[t].m_key = 0;
+	}
+	free(tid);
+}
+
+uint64_t udb_mt_checksum(const udb_mtarg_t *a)
+{
+	uint64_t z = 0;
+	int t;
+	for (t = 0; t < a[0].n_threads; ++t) z += a[t].z;
+	return z;
+}
+
+int64_t udb_mt_count(const udb_mtarg_t *a)
+{
+	int64_t cnt = 0;
+	int t;
+	for (t = 0; t < a[0].n_threads; ++t) cnt += a[t].cnt;
+	return cnt;
+}
+#endif
+
 /*****************
  * Main function *
  *****************/
 
+static int udb_node_size = 0; // node size in bytes for tree-based libraries; 0 for the library default
+
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp);
+#ifdef UDB_TEST_LOOKUP // defined by drivers that implement test_lookup()
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp); // cp[0] after build; cp[1] after lookups
+#endif
+#ifdef UDB_TEST_RANGE // defined by drivers that implement test_range(); also define UDB_TEST_RANK if it fills cp[2]
+uint64_t test_range(uint32_t n, const uint32_t *a, uint32_t n_q, uint32_t len, uint32_t x0, udb_checkpoint_t *cp); // cp[0] after loading a[]; cp[1] after range queries; cp[2] after rank/select queries; return #keys visited
+#endif
+#ifdef UDB_TEST_MIX // defined by drivers that implement test_mix()
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp); // cp[0] after loading n0 keys
+#endif
+// UDB_TEST_LAT: defined by drivers whose test_int() calls udb_lat_begin()/udb_lat_end()
+#ifdef UDB_TEST_MT // defined by drivers that implement test_int_mt()
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads);
+#endif
+
+static void udb_run_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int max_threads)
+{
+#ifdef UDB_TEST_MT
+	int n_threads = 1;
+	for (;;) {
+		udb_checkpoint_t cp0;
+		uint32_t i;
+		udb_measure(0, 0, 0, &cp0);
+		test_int_mt(N, n0, is_del, x0, n_cp, cp, n_threads);
+		for (i = 0; i < n_cp; ++i) {
+			double rt = cp[i].rt - cp0.rt; // wall-clock time, excluding key generation
+			printf("T%c\t%d\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\n", is_del? 'D' : 'I', n_threads, cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
+				rt, cp[i].n_input / rt * 1e-6, rt / cp[i].n_input * 1e6);
+		}
+		if (n_threads == max_threads) break;
+		n_threads = n_threads * 2 < max_threads? n_threads * 2 : max_threads;
+	}
+#else
+	fprintf(stderr, "ERROR: no multi-threaded implementation for this library\n");
+	exit(1);
+#endif
+}
+
+static void udb_run_lookup(uint32_t N, uint32_t n_q, double hit_ratio, uint32_t x0)
+{
+#ifdef UDB_TEST_LOOKUP
+	udb_checkpoint_t cp0, cp[2];
+	double t0, t_keygen, t;
+	uint64_t sum, hit = (uint64_t)(hit_ratio * 4294967296.0);
+
+	t0 = udb_cputime();
+	sum = udb_traverse_lookup(N, n_q, hit, x0);
+	t_keygen = udb_cputime() - t0;
+	printf("TG\t%.3f\t%ld\n", t_keygen, (long)sum);
+
+	udb_measure(0, 0, 0, &cp0);
+	test_lookup(N, n_q, hit, x0, cp);
+	t = (cp[0].t - cp0.t) / N * 1e9;
+	printf("QB\t%d\t%d\t%.3f\t%.3f\t%.2f\t%.2f\n", N, cp[0].table_size, cp[0].t - cp0.t,
+		(cp[0].mem - cp0.mem) * 1e-6, t, (cp[0].mem - cp0.mem) / cp[0].table_size);
+	t = cp[1].t - cp[0].t - t_keygen;
+	printf("QL\t%d\t%.3f\t%lx\t%.3f\t%.2f\t%.3f\n", n_q, hit_ratio, (long)cp[1].checksum, t,
+		n_q? t / n_q * 1e9 : 0.0, cp[1].rt - cp[0].rt);
+#else
+	fprintf(stderr, "ERROR: no lookup implementation for this library\n");
+	exit(1);
+#endif
+}
+
+static void udb_run_range(uint32_t N, uint32_t n_q, uint32_t len, uint32_t x0)
+{
+#ifdef UDB_TEST_RANGE
+	udb_checkpoint_t cp0, cp[3];
+	uint32_t *a;
+	uint64_t n_vis;
+	double t;
+
+	a = udb_sorted_keys(N); // sorting is not timed
+	udb_measure(0, 0, 0, &cp0);
+	n_vis = test_range(N, a, n_q, len, x0, cp);
+	t = (cp[0].t - cp0.t) / N * 1e9;
+	printf("QB\t%d\t%d\t%.3f\t%.3f\t%.2f\t%.2f\n", N, cp[0].table_size, cp[0].t - cp0.t,
+		(cp[0].mem - cp0.mem) * 1e-6, t, (cp[0].mem - cp0.mem) / cp[0].table_size);
+	t = cp[1].t - cp[0].t;
+	printf("QR\t%d\t%d\t%lx\t%.3f\t%ld\t%.2f\t%.2f\n", n_q, len, (long)cp[1].checksum, t, (long)n_vis,
+		n_vis / t * 1e-6, n_q? t / n_q * 1e9 : 0.0); // million keys visited per second; ns per query
+#ifdef UDB_TEST_RANK
+	t = cp[2].t - cp[1].t;
+	printf("QK\t%d\t%lx\t%.3f\t%.2f\n", n_q, (long)cp[2].checksum, t, n_q? t / n_q * 1e9 : 0.0);
+#endif
+	free(a);
+#else
+	fprintf(stderr, "ERROR: no range query implementation for this library\n");
+	exit(1);
+#endif
+}
+
+static void udb_run_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp)
+{
+#ifdef UDB_TEST_MIX
+	static const char *name = "ruid";
+	udb_checkpoint_t cp0, *cp;
+	double t0, t_keygen, tick_ns, oh[4];
+	uint64_t sum;
+	uint32_t i;
+	int c;
+
+	tick_ns = udb_lat_calibrate();
+	udb_mix.n_ins = n0;
+	t0 = udb_cputime();
+	sum = udb_traverse_mix(N, x0);
+	t_keygen = udb_cputime() - t0;
+	printf("TG\t%.3f\t%ld\n", t_keygen, (long)sum);
+	for (c = 0; c < 4; ++c) // timer overhead per operation type
+		oh[c] = udb_mix.n[c]? (double)udb_mix.t[c] / udb_mix.n[c] : 0.0;
+	memset(udb_mix.n, 0, sizeof(udb_mix.n));
+	memset(udb_mix.t, 0, sizeof(udb_mix.t));
+	udb_mix.n_ins = n0;
+
+	cp = (udb_checkpoint_t*)calloc(n_cp + 1, sizeof(*cp));
+	udb_measure(0, 0, 0, &cp0);
+	test_mix(N, n0, x0, n_cp, cp);
+	printf("MP\t%d\t%d\t%.3f\t%.3f\n", n0, cp[0].table_size, cp[0].t - cp0.t, (cp[0].mem - cp0.mem) * 1e-6);
+	for (i = 1; i <= n_cp; ++i) {
+		double t = cp[i].t - cp[0].t - t_keygen * cp[i].n_input / N;
+		printf("MX\t%d\t%d\t%lx\t%.3f\t%.3f\t%.2f", cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
+			t, (cp[i].mem - cp0.mem) * 1e-6, t / cp[i].n_input * 1e9);
+		for (c = 0; c < 4; ++c) { // ns per operation of each type, excluding the timer overhead
+			uint64_t n = cp[i].mix_n[c] - cp[0].mix_n[c];
+			if (n == 0) printf("\t%c:NA", name[c]);
+			else printf("\t%c:%.2f", name[c], ((cp[i].mix_t[c] - cp[0].mix_t[c]) / (double)n - oh[c]) / tick_ns);
+		}
+		if (cp0.rss[0] > 0) printf("\trss:%.3f", (cp[i].rss[0] - cp0.rss[0]) * 1e-6); // current, not peak; shows memory returned after deletions
+		putchar('\n');
+	}
+	free(cp);
+#else
+	fprintf(stderr, "ERROR: no mixed-workload implementation for this library\n");
+	exit(1);
+#endif
+}
 
 int main(int argc, char *argv[])
 {
 	int c;
+	const char *fn_key = 0, *dist_str = "uniform", *mix_str = 0;
+	udb_dist_t dist;
+	uint32_t *gen_keys = 0;
 	double t0, t_keygen;
-	uint64_t sum;
-	uint32_t i, n_cp = 11, N = 80000000, n0 = 10000000, x0 = 1, is_del = 0;
+	uint64_t sum, pmc0[UDB_N_PMC], pmc_keygen[UDB_N_PMC];
+	uint32_t i, n_cp = 11, N = 80000000, n0 = 10000000, x0 = 1, is_del = 0, n_q = 0, n_r = 0, range_len = 100;
+	double hit_ratio = 0.5;
+	int n_threads = 0, use_pmc = 0;
+	double tick_ns = 0.0;
 	udb_checkpoint_t cp0, *cp;
 
-	while ((c = getopt(argc, argv, "n:N:0:k:d")) >= 0) {
+	while ((c = getopt(argc, argv, "n:N:0:k:dt:el:i:D:q:H:m:sb:r:R:")) >= 0) {
 		if (c == 'n') n0 = atol(optarg);
 		else if (c == 'N') N = atol(optarg);
 		else if (c == '0') x0 = atol(optarg);
 		else if (c == 'k') n_cp = atoi(optarg);
 		else if (c == 'd') is_del = 1;
+		else if (c == 'e') use_pmc = 1;
+		else if (c == 'i') fn_key = optarg;
+		else if (c == 'D') dist_str = optarg;
+		else if (c == 'l') udb_lat.k = udb_lat.left = atol(optarg);
+		else if (c == 't') n_threads = atoi(optarg);
+		else if (c == 'q') n_q = atol(optarg);
+		else if (c == 'H') hit_ratio = atof(optarg);
+		else if (c == 'm') mix_str = optarg;
+		else if (c == 's') udb_scan.on = 1;
+		else if (c == 'b') udb_node_size = atoi(optarg);
+		else if (c == 'r') n_r = atol(optarg);
+		else if (c == 'R') range_len = atol(optarg);
+	}
+
+	if (udb_dist_parse(dist_str, &dist, 2654435769U) < 0) {
+		fprintf(stderr, "ERROR: unknown key distribution '%s'\n", dist_str);
+		return 1;
+	}
+	if (mix_str && udb_mix_parse(mix_str, &udb_mix) < 0) {
+		fprintf(stderr, "ERROR: failed to parse workload '%s'\n", mix_str);
+		return 1;
+	}
+	if (udb_scan.on && (mix_str || n_r > 0 || n_q > 0 || n_threads > 0)) {
+		fprintf(stderr, "ERROR: -s only applies to the insertion/deletion test; drop -m, -r, -q and -t\n");
+		return 1;
+	}
+	if ((fn_key || dist.type != UDB_DIST_UNIFORM) && (mix_str || n_r > 0 || n_q > 0)) {
+		fprintf(stderr, "ERROR: -i and -D only apply to the insertion/deletion test; -m, -r and -q generate their own keys\n");
+		return 1;
+	}
+#ifndef UDB_TEST_LAT
+	if (udb_lat.k > 0) {
+		fprintf(stderr, "ERROR: no latency sampling for this library\n");
+		return 1;
+	}
+#endif
+	if (hit_ratio < 0.0 || hit_ratio > 1.0) {
+		fprintf(stderr, "ERROR: -H must be between 0 and 1\n");
+		return 1;
+	}
+	if (fn_key) { // load keys before any measurement
+		uint32_t n_keys = udb_load_keys(fn_key);
+		if (N > n_keys) {
+			fprintf(stderr, "WARNING: reduced -N to the %u keys in file '%s'\n", n_keys, fn_key);
+			N = n_keys;
+			if (n0 > N) n0 = N;
+		}
+	}
+	if (dist.type != UDB_DIST_UNIFORM) { // precompute keys such that generation is not timed
+		if (fn_key) fprintf(stderr, "WARNING: -D is ignored with -i\n");
+		else udb_keys = gen_keys = udb_gen_keys(&dist, N, n0, n_cp, x0);
 	}
 
 	printf("CL\tUsage: run-test [options]\n");
@@ -114,25 +740,101 @@ int main(int argc, char *argv[])
 	printf("CL\t  -N INT     total number of input items [%d]\n", N);
 	printf("CL\t  -n INT     initial number of input items [%d]\n", n0);
 	printf("CL\t  -k INT     number of checkpoints [%d]\n", n_cp);
+	printf("CL\t  -D STR     key distribution: uniform, zipf[:S], seq, stride[:K] or cluster[:L] [%s]\n", dist_str);
+	printf("CL\t  -i FILE    read keys from FILE instead of generating them [%s]\n", fn_key? fn_key : "");
+	printf("CL\t  -s         scan the whole table at each checkpoint and report the scan time separately\n");
+	printf("CL\t  -e         report cycles, instructions, L1D/LLC/dTLB misses per input (Linux only)\n");
+	printf("CL\t  -l INT     time every INT-th operation and report latency percentiles in ns [%d]\n", udb_lat.k);
+	printf("CL\t  -q INT     build a table of -N distinct keys and then perform INT lookups [%d]\n", n_q);
+	printf("CL\t  -H FLOAT   fraction of lookups that hit with -q [%g]\n", hit_ratio);
+	printf("CL\t  -r INT     load -N sorted distinct keys and then perform INT range queries [%d]\n", n_r);
+	printf("CL\t  -R INT     number of keys visited per range query with -r [%d]\n", range_len);
+	printf("CL\t  -m STR     mixed workload on -n loaded keys with -N operations, e.g. r=80,u=10,i=5,d=5 [%s]\n", mix_str? mix_str : "");
+	printf("CL\t  -t INT     evaluate 1, 2, 4, ..., INT threads; 0 for the single-threaded test [%d]\n", n_threads);
+	printf("CL\t  -b INT     node size in bytes for tree-based libraries; 0 for the library default [%d]\n", udb_node_size);
 	printf("CL\n");
 
 	cp = (udb_checkpoint_t*)calloc(n_cp, sizeof(*cp));
 
+	if (mix_str) {
+		udb_run_mix(N, n0, x0, n_cp);
+		free(cp); free(gen_keys);
+		return 0;
+	}
+	if (n_r > 0) {
+		udb_run_range(N, n_r, range_len, x0);
+		free(cp); free(gen_keys);
+		return 0;
+	}
+	if (n_q > 0) {
+		udb_run_lookup(N, n_q, hit_ratio, x0);
+		free(cp); free(gen_keys);
+		return 0;
+	}
+	if (n_threads > 0) {
+		udb_run_mt(N, n0, is_del, x0, n_cp, cp, n_threads);
+		free(cp); free(gen_keys);
+		return 0;
+	}
+
+	if (udb_lat.k > 0) tick_ns = udb_lat_calibrate();
+	if (use_pmc && udb_pmc_init() == 0)
+		fprintf(stderr, "WARNING: failed to open hardware counters\n");
+
+	udb_pmc_read(pmc0);
 	t0 = udb_cputime();
 	sum = udb_traverse_rng(N, x0);
 	t_keygen = udb_cputime() - t0;
+	udb_pmc_read(pmc_keygen);
+	for (i = 0; i < UDB_N_PMC; ++i)
+		pmc_keygen[i] -= pmc0[i];
 	printf("TG\t%.3f\t%ld\n", t_keygen, (long)sum); // need to print sum; otherwise the compiler may optimize udb_traverse_rng() out
 
+	udb_key_i = 0;
 	udb_measure(0, 0, 0, &cp0);
 	test_int(N, n0, is_del, x0, n_cp, cp);
 
 	for (i = 0; i < n_cp; ++i) {
 		double t, m;
-		t = (cp[i].t - cp0.t - t_keygen * cp[i].n_input / N) / cp[i].n_input * 1e6;
+		t = (cp[i].t - cp0.t - cp[i].scan_t - t_keygen * cp[i].n_input / N) / cp[i].n_input * 1e6;
 		m = (cp[i].mem - cp0.mem) / cp[i].table_size;
-		printf("M%c\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\t%.2f\n", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
-			cp[i].t - cp0.t, (cp[i].mem - cp0.mem) * 1e-6, t, m);
+		printf("M%c\t%d\t%d\t%lx\t%.3f\t%.3f\t%.4f\t%.2f", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].checksum,
+			cp[i].t - cp0.t - cp[i].scan_t, (cp[i].mem - cp0.mem) * 1e-6, t, m);
+		printf("\t%.3f\t%.4f", cp[i].rt - cp0.rt, (double)(cp[i].minflt - cp0.minflt) / cp[i].n_input);
+		if (UDB_HEAP_ON) // live and peak heap above the baseline, and the largest spike, in MB
+			printf("\t%.3f\t%.3f\t%.3f", (cp[i].heap[0] - cp0.heap[0]) * 1e-6, (cp[i].heap[1] - cp0.heap[0]) * 1e-6, cp[i].heap[2] * 1e-6);
+		else printf("\tNA\tNA\tNA");
+		if (cp0.rss[0] > 0) // current RSS in MB and per entry, and anonymous and huge-page memory in MB, above the baseline
+			printf("\t%.3f\t%.2f\t%.3f\t%.3f", (cp[i].rss[0] - cp0.rss[0]) * 1e-6, (double)(cp[i].rss[0] - cp0.rss[0]) / cp[i].table_size,
+				(cp[i].rss[1] - cp0.rss[1]) * 1e-6, (cp[i].rss[2] - cp0.rss[2]) * 1e-6);
+		else printf("\tNA\tNA\tNA\tNA");
+		if (use_pmc) { // per input, excluding key generation
+			int k;
+			for (k = 0; k < UDB_N_PMC; ++k) {
+				if (udb_pmc_fd[k] < 0) printf("\tNA");
+				else printf("\t%.3f", (cp[i].pmc[k] - cp0.pmc[k] - (double)pmc_keygen[k] * cp[i].n_input / N) / cp[i].n_input);
+			}
+		}
+		putchar('\n');
 	}
-	free(cp);
+	for (i = 0; udb_scan.on && i < n_cp; ++i) {
+		double t = cp[i].scan_t - (i? cp[i-1].scan_t : 0.0);
+		if (cp[i].scan_n == (i? cp[i-1].scan_n : 0)) { // the driver did not scan before this checkpoint
+			printf("S%c\t%d\t%d\tNA\tNA\tNA\n", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size);
+			continue;
+		}
+		printf("S%c\t%d\t%d\t%lx\t%.3f\t%.3f\n", is_del? 'D' : 'I', cp[i].n_input, cp[i].table_size, (long)cp[i].scan_sum,
+			t, cp[i].table_size? t / cp[i].table_size * 1e9 : 0.0);
+	}
+	for (i = 0; udb_lat.k > 0 && i < n_cp; ++i) {
+		uint32_t j;
+		printf("L%c\t%d\t%ld", is_del? 'D' : 'I', cp[i].n_input, (long)cp[i].lat_n);
+		for (j = 0; j < 4; ++j)
+			printf("\t%.1f", cp[i].lat_q[j] / tick_ns);
+		printf("\t%d\n", cp[i].lat_rh_en - cp[i].lat_rh_st);
+		for (j = cp[i].lat_rh_st; j < cp[i].lat_rh_en; ++j) // samples that triggered a rehash
+			printf("LR\t%d\t%.1f\n", cp[i].n_input, udb_lat.rh[j] / tick_ns);
+	}
+	free(cp); free(udb_lat.rh); free(gen_keys);
 	return 0;
 }
@@ -38,6 +38,11 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++p.ref->val;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			foreach (umap_aux, &h, it) s += it.ref->val;
+			udb_scan_end(s);
+		}
 		udb_measure(n, umap_aux_size(&h), z, &cp[j]);
 	}
 	umap_aux_free(&h);
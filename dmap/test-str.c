@@ -0,0 +1,31 @@
+#define UDB_TEST_NO_DEL // dmap never reuses deleted slots, so alternating insertions and deletions fill the table and probing loops forever
+#include "../common-str.c"
+#include "dmap.h"
+
+static inline uint32_t *str_get(uint32_t *h, const char *key, size_t len) // dmap reports a key size error on lookups before the first insertion
+{
+	return dmap_count(h)? dmap_kstr_get(h, (void*)key, len) : 0;
+}
+
+void test_str(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j, cnt = 0;
+	uint64_t z = 0, x = x0;
+	uint32_t *h = 0;
+	dmap_kstr_init(h, 0, 0); // DMAP_STR keys are identified by two hashes; the contents are not stored
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			const char *key = udb_get_key(n, y);
+			size_t len = strlen(key);
+			uint32_t v = 1, *val = str_get(h, key, len);
+			if (val) v += *val;
+			else ++cnt;
+			dmap_kstr_insert(h, (void*)key, len, v);
+			z += v;
+		}
+		udb_measure(n, cnt, z, &cp[j]);
+	}
+	dmap_free(h);
+}
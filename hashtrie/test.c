@@ -1,3 +1,4 @@
+#define UDB_TEST_MT
 #include "../common.c"
 #include <stdlib.h>
 #include <stddef.h>
@@ -14,9 +15,13 @@ typedef unsigned char byte;
 typedef ptrdiff_t     size;
 typedef uintptr_t     uptr;
 
+typedef struct map map;
+
 typedef struct {
 	byte *beg;
 	byte *end;
+	map  *free;  // recycled nodes, linked through child[0]
+	size  n_new; // number of nodes linked into the trie from this arena
 } arena;
 
 static byte *alloc(arena *a, size objsize, size align, size count, bool zero)
@@ -30,13 +35,29 @@ static byte *alloc(arena *a, size objsize, size align, size count, bool zero)
 	return zero ? memset(r, 0, objsize*count) : r;
 }
 
-typedef struct map map;
 struct map {
 	map *child[4];
 	uint32_t  key;
-	uint32_t  value;
+	uint32_t  value; // 0 for a deleted key (tombstone)
 };
 
+static map *node_new(arena *a)
+{
+	map *r = a->free;
+	if (r) {
+		a->free = r->child[0];
+		memset(r, 0, sizeof(*r));
+		return r;
+	}
+	return new(a, map, 1);
+}
+
+static void node_free(arena *a, map *r)
+{
+	r->child[0] = a->free;
+	a->free = r;
+}
+
 // Thread-safe, lock-free insert/search.
 static uint32_t *upsert(map **m, uint32_t key, arena *a)
 {
@@ -46,15 +67,15 @@ static uint32_t *upsert(map **m, uint32_t key, arena *a)
 			if (!a) {
 				return 0;
 			}
-			arena rollback = *a;
-			map *new = new(a, map, 1);
+			map *new = node_new(a);
 			new->key = key;
 			int pass = __ATOMIC_RELEASE;
 			int fail = __ATOMIC_ACQUIRE;
 			if (__atomic_compare_exchange_n(m, &n, new, 0, pass, fail)) {
+				++a->n_new;
 				return &new->value;
 			}
-			*a = rollback;
+			node_free(a, new); // n now points to the node inserted by another thread
 		}
 		if (n->key == key) return &n->value;
 		m = n->child + (h >> 62);
@@ -62,12 +83,48 @@ static uint32_t *upsert(map **m, uint32_t key, arena *a)
 	return 0;
 }
 
+// Not thread-safe. Remove deleted leaves and move a leaf up into each
+// deleted internal node; this is valid because a node on the hash path of
+// a key is visited before its descendants. Freed nodes are distributed to
+// arenas in turn. Return the number of nodes freed.
+static size compact(map **m, arena *a, int n_arena, int *rr)
+{
+	map *n = *m, **q;
+	size freed = 0;
+	int k;
+	if (!n) return 0;
+	for (k = 0; k < 4; ++k)
+		freed += compact(&n->child[k], a, n_arena, rr);
+	if (n->value) return freed;
+	for (q = m;;) { // find a leaf, which is live as deleted leaves have been removed
+		for (k = 0; k < 4 && !(*q)->child[k]; ++k) {}
+		if (k == 4) break;
+		q = &(*q)->child[k];
+	}
+	if (*q != n) n->key = (*q)->key, n->value = (*q)->value;
+	node_free(&a[(*rr)++ % n_arena], *q);
+	*q = 0;
+	return freed + 1;
+}
+
+static uint64_t trie_sum(const map *m) // sum of values; deleted keys are 0
+{
+	uint64_t s;
+	int k;
+	if (!m) return 0;
+	for (s = m->value, k = 0; k < 4; ++k)
+		s += trie_sum(m->child[k]);
+	return s;
+}
+
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
 	uint32_t step = (N - n0) / (n_cp - 1);
 	uint32_t i, n, j, cnt = 0;
 	uint64_t z = 0, x = x0;
 	uint64_t cap = N * sizeof(map) / 2;
+	size n_freed = 0;
+	int rr = 0;
 	byte *heap = malloc(cap);
 	arena perm = {0};
 	perm.beg = heap;
@@ -77,14 +134,88 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 		for (; i < n; ++i) {
 			uint64_t y = udb_splitmix64(&x);
 			uint32_t key = udb_get_key(n, y);
-			if (is_del) {
+			uint32_t *p = upsert(&m, key, &perm);
+			if (is_del) { // values are i+1 such that 0 marks a deleted key
+				if (*p == 0) *p = i + 1, ++cnt, ++z;
+				else *p = 0, --cnt;
 			} else {
-				uint32_t *p = upsert(&m, key, &perm);
 				if (*p == 0) ++cnt;
 				z += ++*p;
 			}
 		}
+#ifndef NO_COMPACT
+		if (perm.n_new - n_freed - cnt > cnt) // more deleted nodes than live ones
+			n_freed += compact(&m, &perm, 1, &rr);
+#endif
+		if (udb_scan_begin()) {
+			uint64_t s = trie_sum(m);
+			udb_scan_end(is_del? s - cnt : s); // values are i+1 with -d
+		}
 		udb_measure(n, cnt, z, &cp[j]);
 	}
 	free(heap);
 }
+
+typedef struct {
+	map *m;
+	arena *perm; // one arena per thread
+} mt_trie_t;
+
+static void *worker_int(void *data) // all threads share one trie
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	mt_trie_t *t = (mt_trie_t*)a->h;
+	size_t j;
+	for (j = 0; j < a->n_key; ++j) {
+		uint32_t key = a->key[j].key, i = a->key[j].i;
+		uint32_t *p = upsert(&t->m, key, &t->perm[a->tid]);
+		if (a->is_del) { // toggle with CAS; a failure means another thread has toggled it first
+			uint32_t v = __atomic_load_n(p, __ATOMIC_RELAXED);
+			while (1) {
+				uint32_t w = v? 0 : i + 1;
+				if (__atomic_compare_exchange_n(p, &v, w, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					if (w) ++a->cnt, ++a->z;
+					else --a->cnt;
+					break;
+				}
+			}
+		} else {
+			uint32_t v = __atomic_add_fetch(p, 1, __ATOMIC_RELAXED);
+			if (v == 1) ++a->cnt;
+			a->z += v;
+		}
+	}
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t cap = (uint64_t)N * sizeof(map) / 2 / n_threads + 4096;
+	byte *heap = malloc(cap * n_threads);
+	mt_trie_t t = {0};
+	udb_mtarg_t *a;
+	size n_freed = 0;
+	int k, rr = 0;
+	t.perm = (arena*)calloc(n_threads, sizeof(arena));
+	for (k = 0; k < n_threads; ++k) {
+		t.perm[k].beg = heap + cap * k;
+		t.perm[k].end = heap + cap * (k + 1);
+	}
+	a = udb_mt_init(n_threads, is_del, x0, &t);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		int64_t cnt;
+		size n_node = -n_freed;
+		udb_mt_step(a, i, n, UDB_MT_SLICE, worker_int);
+		cnt = udb_mt_count(a);
+		for (k = 0; k < n_threads; ++k)
+			n_node += t.perm[k].n_new;
+#ifndef NO_COMPACT
+		if (n_node - cnt > cnt) // between steps, so no other thread is running
+			n_freed += compact(&t.m, t.perm, n_threads, &rr);
+#endif
+		udb_measure(n, cnt, udb_mt_checksum(a), &cp[j]);
+	}
+	free(a); free(t.perm); free(heap);
+}
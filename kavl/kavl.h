@@ -105,6 +105,16 @@ int main(void) {
 		if (lower) *lower = (__type*)l; \
 		if (upper) *upper = (__type*)u; \
 		return (__type*)p; \
+	} \
+	__scope __type *kavl_select_##suf(const __type *root, unsigned k) { \
+		const __type *p = root; \
+		while (p != 0) { \
+			unsigned s = kavl_size_child(__head, p, 0); \
+			if (k < s) p = p->__head.p[0]; \
+			else if (k > s) k -= s + 1, p = p->__head.p[1]; \
+			else break; \
+		} \
+		return (__type*)p; \
 	}
 
 #define __KAVL_ROTATE(suf, __type, __head) \
@@ -268,6 +278,26 @@ int main(void) {
 		return p; \
 	}
 
+#define __KAVL_BUILD(suf, __scope, __type, __head) \
+	static int kavl_build_aux_##suf(__type **a, unsigned n, __type **root) { /* return the height */ \
+		unsigned m = n >> 1; \
+		int hl, hr; \
+		if (n == 0) { \
+			*root = 0; \
+			return 0; \
+		} \
+		hl = kavl_build_aux_##suf(a, m, &a[m]->__head.p[0]); \
+		hr = kavl_build_aux_##suf(a + m + 1, n - m - 1, &a[m]->__head.p[1]); \
+		a[m]->__head.balance = hr - hl, a[m]->__head.size = n; \
+		*root = a[m]; \
+		return (hl > hr? hl : hr) + 1; \
+	} \
+	__scope __type *kavl_build_##suf(unsigned n, __type **a) { \
+		__type *root; \
+		kavl_build_aux_##suf(a, n, &root); \
+		return root; \
+	}
+
 #define kavl_free(__type, __head, __root, __free) do { \
 		__type *_p, *_q; \
 		for (_p = __root; _p; _p = _q) { \
@@ -284,41 +314,43 @@ int main(void) {
 
 #define __KAVL_ITR(suf, __scope, __type, __head, __cmp) \
 	struct kavl_itr_##suf { \
-		const __type *stack[KAVL_MAX_DEPTH], **top; \
+		const __type *stack[KAVL_MAX_DEPTH], **top; /* top points past the current node */ \
 	}; \
 	__scope void kavl_itr_first_##suf(const __type *root, struct kavl_itr_##suf *itr) { \
 		const __type *p; \
-		for (itr->top = itr->stack - 1, p = root; p; p = p->__head.p[0]) \
-			*++itr->top = p; \
-	} \
-	__scope int kavl_itr_find_##suf(const __type *root, const __type *x, struct kavl_itr_##suf *itr) { \
-		const __type *p = root; \
-		itr->top = itr->stack - 1; \
-		while (p != 0) { \
-			int cmp; \
-			*++itr->top = p; \
-			cmp = __cmp(x, p); \
-			if (cmp < 0) p = p->__head.p[0]; \
-			else if (cmp > 0) p = p->__head.p[1]; \
-			else break; \
-		} \
-		return p? 1 : 0; \
+		for (itr->top = itr->stack, p = root; p; p = p->__head.p[0]) \
+			*itr->top++ = p; \
 	} \
 	__scope int kavl_itr_next_bidir_##suf(struct kavl_itr_##suf *itr, int dir) { \
 		const __type *p; \
-		if (itr->top < itr->stack) return 0; \
+		if (itr->top == itr->stack) return 0; \
 		dir = !!dir; \
-		p = (*itr->top)->__head.p[dir]; \
+		p = itr->top[-1]->__head.p[dir]; \
 		if (p) { /* go down */ \
 			for (; p; p = p->__head.p[!dir]) \
-				*++itr->top = p; \
+				*itr->top++ = p; \
 			return 1; \
 		} else { /* go up */ \
 			do { \
-				p = *itr->top--; \
-			} while (itr->top >= itr->stack && p == (*itr->top)->__head.p[dir]); \
-			return itr->top < itr->stack? 0 : 1; \
+				p = *--itr->top; \
+			} while (itr->top > itr->stack && p == itr->top[-1]->__head.p[dir]); \
+			return itr->top == itr->stack? 0 : 1; \
+		} \
+	} \
+	__scope int kavl_itr_find_##suf(const __type *root, const __type *x, struct kavl_itr_##suf *itr) { \
+		const __type *p = root; \
+		int cmp = 0; \
+		itr->top = itr->stack; \
+		while (p != 0) { \
+			*itr->top++ = p; \
+			cmp = __cmp(x, p); \
+			if (cmp < 0) p = p->__head.p[0]; \
+			else if (cmp > 0) p = p->__head.p[1]; \
+			else break; \
 		} \
+		if (p) return 1; \
+		if (cmp > 0) kavl_itr_next_bidir_##suf(itr, 1); /* the last node is smaller than x; move to its successor */ \
+		return 0; \
 	} \
 
 /**
@@ -346,6 +378,28 @@ int main(void) {
 #define kavl_find(suf, root, x, cnt) kavl_find_##suf(root, x, cnt)
 #define kavl_interval(suf, root, x, lower, upper) kavl_interval_##suf(root, x, lower, upper)
 
+/**
+ * Find the k-th smallest node in the tree
+ *
+ * @param suf     name suffix used in KAVL_INIT()
+ * @param root    root of the tree
+ * @param k       0-based rank
+ *
+ * @return the node with _k_ smaller nodes, or NULL if k >= tree size
+ */
+#define kavl_select(suf, root, k) kavl_select_##suf(root, k)
+
+/**
+ * Build a perfectly balanced tree from sorted nodes
+ *
+ * @param suf     name suffix used in KAVL_INIT()
+ * @param n       number of nodes
+ * @param a       nodes in the ascending order without duplicates (in)
+ *
+ * @return root of the new tree
+ */
+#define kavl_build(suf, n, a) kavl_build_##suf(n, a)
+
 /**
  * Delete a node from the tree
  *
@@ -399,13 +453,14 @@ int main(void) {
  *
  * @return pointer if present; NULL otherwise
  */
-#define kavl_at(itr) ((itr)->top < (itr)->stack? 0 : *(itr)->top)
+#define kavl_at(itr) ((itr)->top == (itr)->stack? 0 : (itr)->top[-1])
 
 #define KAVL_INIT2(suf, __scope, __type, __head, __cmp) \
 	__KAVL_FIND(suf, __scope, __type, __head,  __cmp) \
 	__KAVL_ROTATE(suf, __type, __head) \
 	__KAVL_INSERT(suf, __scope, __type, __head, __cmp) \
 	__KAVL_ERASE(suf, __scope, __type, __head, __cmp) \
+	__KAVL_BUILD(suf, __scope, __type, __head) \
 	__KAVL_ITR(suf, __scope, __type, __head, __cmp)
 
 #define KAVL_INIT(suf, __type, __head, __cmp) \
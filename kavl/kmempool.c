@@ -1,36 +1,211 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "kmempool.h"
 
-#define Malloc(type, cnt)       ((type*)malloc((cnt) * sizeof(type)))
+/* Fixed-size allocator. Entries are carved from 2^chunk_bits-byte chunks
+ * aligned to their size, so the chunk of an entry is found by masking its
+ * address. Each chunk keeps an intrusive free list and counts the entries not
+ * on it. When the count drops to zero, the chunk is kept as a spare if fewer
+ * than KMP_N_SPARE chunks are spare; otherwise its pages are handed back with
+ * madvise(MADV_DONTNEED). Spare and then released chunks are reused before a
+ * new one is mapped, so alloc/free around a chunk boundary costs no syscall.
+ *
+ * Each thread has a magazine of up to KMP_MAG entries in front of the shared
+ * chunks, which are protected by a mutex. alloc/free only take the lock to
+ * move KMP_MAG/2 entries between a magazine and the chunks. A thread takes a
+ * magazine slot on first use; when it exits, a pthread key destructor
+ * returns the cached entries and frees the slot for the next thread. */
+
+#define KMP_MAG         64 // magazine size
+#define KMP_MAX_THREADS 64 // live threads beyond this go to the chunks directly
+#define KMP_HDR         64 // bytes reserved for the chunk header
+#define KMP_N_SPARE     1  // fully free chunks kept resident
+
 #define Calloc(type, cnt)       ((type*)calloc((cnt), sizeof(type)))
-#define Realloc(type, ptr, cnt) ((type*)realloc((ptr), (cnt) * sizeof(type)))
-
-typedef struct {
-	uint32_t sz; // size of an entry
-	uint32_t chunk_size; // number of entries in a chunk
-	uint32_t n_chunk; // number of chunks
-	uint8_t *p; // pointing to an entry that can be allocated from a chunk
-	uint8_t *p_end; // end of the current chunk
-	uint8_t **chunk; // list of chunks
-	uint32_t n_buf, m_buf; // number/max number of buffered free entries
-	void **buf; // list of pointers to free entries
+
+typedef struct kmp_chunk_s {
+	struct kmp_chunk_s *prev, *next; // in the partial, spare or released list; both NULL if full
+	struct kmp_chunk_s *next_all;
+	void *free; // free list of entries
+	uint32_t n_used, n_bump; // #entries not on the free list; #entries ever carved
+	int on_list;
+} kmp_chunk_t;
+
+struct kmempool_s;
+
+typedef union {
+	struct { struct kmempool_s *mp; int n, busy; void *p[KMP_MAG]; } s; // busy: the slot is taken by a live thread
+	char pad[(sizeof(int) * 2 + sizeof(void*) * (KMP_MAG + 2) + 63) / 64 * 64]; // avoid false sharing between threads
+} kmp_mag_t;
+
+typedef struct kmempool_s {
+	uint32_t sz, chunk_bits, cap; // entry size; log2 chunk size; entries per chunk
+	pthread_mutex_t lock;
+	kmp_chunk_t partial, spare, released; // sentinels of circular lists
+	kmp_chunk_t *all;
+	uint64_t n_chunk, n_spare, n_released, n_used;
+	kmp_mag_t *mag; // per-thread magazines; aligned to 64 bytes
+	void *mag_mem;
+	pthread_key_t key; // the calling thread's magazine; the destructor flushes it
+	uint64_t id; // unique across pools, for the per-thread cache below
 } kmempool_t;
 
-static void kmp_add_chunk(kmempool_t *mp) // add a new chunk
+static uint64_t kmp_n_pool;
+static __thread uint64_t kmp_cache_id; // pool of the cached magazine; 0 for none
+static __thread kmp_mag_t *kmp_cache_mag;
+
+static inline kmp_chunk_t *kmp_chunk_of(const kmempool_t *mp, void *p)
+{
+	return (kmp_chunk_t*)((uintptr_t)p & ~(((uintptr_t)1 << mp->chunk_bits) - 1));
+}
+
+static inline void kmp_list_del(kmp_chunk_t *c)
+{
+	c->prev->next = c->next, c->next->prev = c->prev;
+	c->prev = c->next = 0, c->on_list = 0;
+}
+
+static inline void kmp_list_push(kmp_chunk_t *head, kmp_chunk_t *c)
+{
+	c->next = head->next, c->prev = head;
+	head->next->prev = c, head->next = c;
+	c->on_list = 1;
+}
+
+static kmp_chunk_t *kmp_map_chunk(kmempool_t *mp) // a new chunk aligned to its size
+{
+	size_t len = (size_t)1 << mp->chunk_bits;
+	uint8_t *p, *q;
+	kmp_chunk_t *c;
+	p = (uint8_t*)mmap(0, len * 2, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return 0;
+	q = (uint8_t*)(((uintptr_t)p + len - 1) & ~(uintptr_t)(len - 1));
+	if (q > p) munmap(p, q - p);
+	munmap(q + len, p + len - q);
+	c = (kmp_chunk_t*)q;
+	c->next_all = mp->all, mp->all = c;
+	++mp->n_chunk;
+	return c;
+}
+
+static void kmp_release_chunk(kmempool_t *mp, kmp_chunk_t *c) // c is fully free
+{
+	size_t page = sysconf(_SC_PAGESIZE), len = (size_t)1 << mp->chunk_bits;
+	if (c->on_list) kmp_list_del(c);
+	if (mp->n_spare < KMP_N_SPARE) { // keep the pages and the free list
+		kmp_list_push(&mp->spare, c);
+		++mp->n_spare;
+		return;
+	}
+	madvise((uint8_t*)c + page, len - page, MADV_DONTNEED); // keep the page holding the header
+	c->free = 0, c->n_bump = 0;
+	kmp_list_push(&mp->released, c);
+	++mp->n_released;
+}
+
+static int kmp_get_locked(kmempool_t *mp, int n, void **p) // take n entries from the chunks
+{
+	int k = 0;
+	while (k < n) {
+		kmp_chunk_t *c = mp->partial.next;
+		if (c == &mp->partial) { // no partial chunk; reuse a spare or released one, or map a new one
+			if (mp->spare.next != &mp->spare) {
+				c = mp->spare.next;
+				kmp_list_del(c);
+				--mp->n_spare;
+			} else if (mp->released.next != &mp->released) {
+				c = mp->released.next;
+				kmp_list_del(c);
+				--mp->n_released;
+			} else if ((c = kmp_map_chunk(mp)) == 0) {
+				break;
+			}
+			kmp_list_push(&mp->partial, c);
+		}
+		while (k < n) {
+			if (c->free) {
+				p[k] = c->free;
+				c->free = *(void**)c->free;
+			} else if (c->n_bump < mp->cap) {
+				p[k] = (uint8_t*)c + KMP_HDR + (size_t)c->n_bump++ * mp->sz;
+			} else break;
+			++c->n_used, ++k;
+		}
+		if (c->free == 0 && c->n_bump == mp->cap) kmp_list_del(c); // full
+	}
+	mp->n_used += k;
+	return k;
+}
+
+static void kmp_put_locked(kmempool_t *mp, int n, void **p) // return n entries to their chunks
+{
+	int k;
+	for (k = 0; k < n; ++k) {
+		kmp_chunk_t *c = kmp_chunk_of(mp, p[k]);
+		*(void**)p[k] = c->free, c->free = p[k];
+		if (!c->on_list) kmp_list_push(&mp->partial, c); // was full
+		if (--c->n_used == 0) kmp_release_chunk(mp, c);
+	}
+	mp->n_used -= n;
+}
+
+static void kmp_mag_exit(void *data) // key destructor; runs in the exiting thread
+{
+	kmp_mag_t *m = (kmp_mag_t*)data;
+	kmempool_t *mp = m->s.mp;
+	pthread_mutex_lock(&mp->lock);
+	kmp_put_locked(mp, m->s.n, m->s.p);
+	m->s.n = 0, m->s.busy = 0;
+	pthread_mutex_unlock(&mp->lock);
+	if (kmp_cache_mag == m) kmp_cache_id = 0;
+}
+
+static kmp_mag_t *kmp_mag_slow(kmempool_t *mp)
 {
-	uint64_t x = (uint64_t)mp->sz * mp->chunk_size;
-	mp->chunk = Realloc(uint8_t*, mp->chunk, mp->n_chunk + 1);
-	mp->p = mp->chunk[mp->n_chunk++] = Calloc(uint8_t, x);
-	mp->p_end = mp->p + x;
+	kmp_mag_t *m = (kmp_mag_t*)pthread_getspecific(mp->key);
+	if (m == 0) { // first use in this thread; take a free slot
+		int i;
+		pthread_mutex_lock(&mp->lock);
+		for (i = 0; i < KMP_MAX_THREADS; ++i)
+			if (!mp->mag[i].s.busy) break;
+		if (i < KMP_MAX_THREADS) {
+			m = &mp->mag[i];
+			m->s.busy = 1;
+			pthread_setspecific(mp->key, m);
+		}
+		pthread_mutex_unlock(&mp->lock);
+		if (m == 0) return 0;
+	}
+	kmp_cache_id = mp->id, kmp_cache_mag = m;
+	return m;
+}
+
+static inline kmp_mag_t *kmp_mag(kmempool_t *mp)
+{
+	return kmp_cache_id == mp->id? kmp_cache_mag : kmp_mag_slow(mp);
 }
 
 void *kmp_init2(unsigned sz, unsigned chunk_size)
 {
 	kmempool_t *mp;
+	int i;
 	mp = Calloc(kmempool_t, 1);
-	mp->sz = sz, mp->chunk_size = chunk_size;
-	kmp_add_chunk(mp);
+	mp->sz = (sz + 7) / 8 * 8; // room and alignment for the free-list pointer
+	for (mp->chunk_bits = 12; ((size_t)1 << mp->chunk_bits) < KMP_HDR + (size_t)mp->sz * chunk_size; ++mp->chunk_bits) {} // chunks are aligned powers of 2
+	mp->cap = (((size_t)1 << mp->chunk_bits) - KMP_HDR) / mp->sz;
+	pthread_mutex_init(&mp->lock, 0);
+	mp->partial.next = mp->partial.prev = &mp->partial;
+	mp->spare.next = mp->spare.prev = &mp->spare;
+	mp->released.next = mp->released.prev = &mp->released;
+	mp->mag_mem = calloc(KMP_MAX_THREADS * sizeof(kmp_mag_t) + 63, 1);
+	mp->mag = (kmp_mag_t*)(((uintptr_t)mp->mag_mem + 63) & ~(uintptr_t)63);
+	for (i = 0; i < KMP_MAX_THREADS; ++i) mp->mag[i].s.mp = mp;
+	pthread_key_create(&mp->key, kmp_mag_exit);
+	mp->id = __atomic_add_fetch(&kmp_n_pool, 1, __ATOMIC_RELAXED);
 	return mp;
 }
 
@@ -42,32 +217,96 @@ void *kmp_init(unsigned sz) // fixed chunk size
 void kmp_destroy(void *mp_)
 {
 	kmempool_t *mp = (kmempool_t*)mp_;
-	uint32_t i;
-	for (i = 0; i < mp->n_chunk; ++i) // free all chunks
-		free(mp->chunk[i]);
-	free(mp->chunk); free(mp->buf); free(mp);
+	kmp_chunk_t *c, *next;
+	for (c = mp->all; c; c = next) { // unmap all chunks
+		next = c->next_all;
+		munmap(c, (size_t)1 << mp->chunk_bits);
+	}
+	pthread_key_delete(mp->key); // destructors no longer run for this pool
+	pthread_mutex_destroy(&mp->lock);
+	free(mp->mag_mem); free(mp);
 }
 
 void *kmp_alloc(void *mp_)
 {
 	kmempool_t *mp = (kmempool_t*)mp_;
-	void *ret;
-	if (mp->n_buf > 0) { // there are buffered free entries
-		ret = mp->buf[--mp->n_buf];
-	} else { // need to "allocate" from chunks
-		if (mp->p == mp->p_end) kmp_add_chunk(mp); // chunk full; add a new one
-		ret = (void*)mp->p;
-		mp->p += mp->sz;
-	}
+	kmp_mag_t *m = kmp_mag(mp);
+	void *ret = 0;
+	if (m && m->s.n > 0) return m->s.p[--m->s.n];
+	pthread_mutex_lock(&mp->lock);
+	if (m) { // refill half of the magazine
+		m->s.n = kmp_get_locked(mp, KMP_MAG / 2, m->s.p);
+		if (m->s.n > 0) ret = m->s.p[--m->s.n];
+	} else kmp_get_locked(mp, 1, &ret);
+	pthread_mutex_unlock(&mp->lock);
 	return ret;
 }
 
 void kmp_free(void *mp_, void *p)
 {
 	kmempool_t *mp = (kmempool_t*)mp_;
-	if (mp->n_buf == mp->m_buf) { // then enlarge the buffer
-		mp->m_buf += (mp->m_buf>>1) + 16;
-		mp->buf = Realloc(void*, mp->buf, mp->m_buf);
+	kmp_mag_t *m = kmp_mag(mp);
+	if (m && m->s.n < KMP_MAG) {
+		m->s.p[m->s.n++] = p;
+		return;
 	}
-	mp->buf[mp->n_buf++] = p;
+	pthread_mutex_lock(&mp->lock);
+	if (m) { // flush the older half of the magazine
+		kmp_put_locked(mp, KMP_MAG / 2, m->s.p);
+		memmove(m->s.p, m->s.p + KMP_MAG / 2, (KMP_MAG - KMP_MAG / 2) * sizeof(void*));
+		m->s.n -= KMP_MAG / 2;
+		m->s.p[m->s.n++] = p;
+	} else kmp_put_locked(mp, 1, &p);
+	pthread_mutex_unlock(&mp->lock);
+}
+
+int kmp_alloc_bulk(void *mp_, int n, void **p)
+{
+	kmempool_t *mp = (kmempool_t*)mp_;
+	kmp_mag_t *m = kmp_mag(mp);
+	int k = 0;
+	if (m) // drain the magazine first
+		while (k < n && m->s.n > 0)
+			p[k++] = m->s.p[--m->s.n];
+	if (k < n) { // then take the rest under a single lock
+		pthread_mutex_lock(&mp->lock);
+		k += kmp_get_locked(mp, n - k, p + k);
+		pthread_mutex_unlock(&mp->lock);
+	}
+	return k;
+}
+
+void kmp_free_bulk(void *mp_, int n, void **p)
+{
+	kmempool_t *mp = (kmempool_t*)mp_;
+	kmp_mag_t *m = kmp_mag(mp);
+	int k = 0;
+	if (m) // fill the magazine first
+		while (k < n && m->s.n < KMP_MAG)
+			m->s.p[m->s.n++] = p[k++];
+	if (k < n) {
+		pthread_mutex_lock(&mp->lock);
+		kmp_put_locked(mp, n - k, p + k);
+		pthread_mutex_unlock(&mp->lock);
+	}
+}
+
+void kmp_flush(void *mp_)
+{
+	kmempool_t *mp = (kmempool_t*)mp_;
+	kmp_mag_t *m = kmp_mag(mp);
+	if (m == 0 || m->s.n == 0) return;
+	pthread_mutex_lock(&mp->lock);
+	kmp_put_locked(mp, m->s.n, m->s.p);
+	m->s.n = 0;
+	pthread_mutex_unlock(&mp->lock);
+}
+
+void kmp_stat(void *mp_, kmp_stat_t *st)
+{
+	kmempool_t *mp = (kmempool_t*)mp_;
+	pthread_mutex_lock(&mp->lock);
+	st->n_chunk = mp->n_chunk, st->n_spare = mp->n_spare, st->n_released = mp->n_released;
+	st->n_used = mp->n_used, st->capacity = mp->cap;
+	pthread_mutex_unlock(&mp->lock);
 }
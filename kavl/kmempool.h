@@ -5,10 +5,23 @@
 extern "C" {
 #endif
 
+typedef struct {
+	unsigned long n_chunk;    // chunks ever mapped
+	unsigned long n_spare;    // fully free chunks kept resident
+	unsigned long n_released; // chunks whose pages have been returned to the OS
+	unsigned long n_used;     // entries not in a chunk free list, including those cached by threads
+	unsigned long capacity;   // entries per chunk
+} kmp_stat_t;
+
 void *kmp_init(unsigned sz);
+void *kmp_init2(unsigned sz, unsigned chunk_size); // chunk_size: min #entries per chunk; rounded up to a power-of-2 chunk in bytes
 void kmp_destroy(void *mp);
 void *kmp_alloc(void *mp);
 void kmp_free(void *mp, void *p);
+int kmp_alloc_bulk(void *mp, int n, void **p); // return the number of entries allocated
+void kmp_free_bulk(void *mp, int n, void **p);
+void kmp_flush(void *mp); // return the calling thread's cached entries to the pool
+void kmp_stat(void *mp, kmp_stat_t *st);
 
 #ifdef __cplusplus
 }
@@ -1,3 +1,5 @@
+#define UDB_TEST_RANGE
+#define UDB_TEST_RANK
 #include "../common.c"
 #include "kavl.h"
 #include "kmempool.h"
@@ -10,6 +12,16 @@ typedef struct aux_s {
 #define aux_cmp(a, b) (((a)->key > (b)->key) - ((a)->key < (b)->key))
 KAVL_INIT(32, aux_t, head, aux_cmp)
 
+static uint64_t tree_sum(const aux_t *p) // sum of counts; recurse on left children and loop on right ones
+{
+	uint64_t s = 0;
+	for (; p; p = p->head.p[1]) {
+		s += tree_sum(p->head.p[0]);
+		s += p->cnt;
+	}
+	return s;
+}
+
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
 	uint32_t step = (N - n0) / (n_cp - 1);
@@ -24,12 +36,61 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 			p->key = udb_get_key(n, y);
 			q = kavl_insert(32, &root, p, 0);
 			if (is_del) {
+				if (p == q) {
+					q->cnt = i, ++z;
+					p = (aux_t*)kmp_alloc(mp);
+				} else kmp_free(mp, kavl_erase(32, &root, q, 0)); // erase the existing node and recycle it
 			} else {
 				if (p == q) p = (aux_t*)kmp_alloc(mp);
 				z += ++q->cnt;
 			}
 		}
+		if (udb_scan_begin()) {
+			udb_scan_end(tree_sum(root));
+		}
 		udb_measure(n, kavl_size(head, root), z, &cp[j]);
 	}
 	kmp_destroy(mp);
 }
+
+uint64_t test_range(uint32_t n, const uint32_t *a, uint32_t n_q, uint32_t len, uint32_t x0, udb_checkpoint_t *cp)
+{
+	uint32_t i;
+	uint64_t z = 0, n_vis = 0, x = x0;
+	aux_t *root, **b;
+	void *mp = kmp_init(sizeof(aux_t));
+	b = (aux_t**)malloc(n * sizeof(aux_t*));
+	for (i = 0; i < n; ++i) {
+		b[i] = (aux_t*)kmp_alloc(mp);
+		b[i]->key = a[i], b[i]->cnt = i;
+	}
+	root = kavl_build(32, n, b);
+	free(b);
+	udb_measure(n, kavl_size(head, root), 0, &cp[0]);
+	for (i = 0; i < n_q; ++i) {
+		kavl_itr_t(32) itr;
+		const aux_t *p;
+		aux_t q;
+		uint32_t l;
+		q.key = udb_range_key(&x);
+		kavl_itr_find(32, root, &q, &itr); // the first key >= q
+		for (l = 0, p = kavl_at(&itr); p && l < len; ++l, p = kavl_itr_next(32, &itr)? kavl_at(&itr) : 0)
+			z += p->cnt;
+		n_vis += l;
+	}
+	udb_measure(n_q, kavl_size(head, root), z, &cp[1]);
+	for (i = 0, z = 0; i < n_q; ++i) { // alternate between rank and select on subtree sizes
+		uint64_t y = udb_splitmix64(&x);
+		uint32_t r = (y >> 32) % n;
+		if (y & 1) {
+			aux_t q;
+			unsigned cnt;
+			q.key = a[r];
+			kavl_find(32, root, &q, &cnt); // cnt == r + 1
+			z += cnt;
+		} else z += kavl_select(32, root, r)->cnt + 1;
+	}
+	udb_measure(n_q, kavl_size(head, root), z, &cp[2]);
+	kmp_destroy(mp);
+	return n_vis;
+}
@@ -31,9 +31,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #define KB_MAX_DEPTH 64
 
+#ifndef KB_NODE_ALIGN
+#define KB_NODE_ALIGN 64 /* nodes start at a cache line; node sizes are rounded up to a multiple of this */
+#endif
+
 typedef struct {
 	int32_t is_internal:1, n:31;
 } kbnode_t;
@@ -50,6 +57,13 @@ typedef struct {
 #define	__KB_KEY(type, x)	((type*)((char*)x + 4))
 #define __KB_PTR(btr, x)	((kbnode_t**)((char*)x + btr->off_ptr))
 
+static inline kbnode_t *__kb_node_calloc(int len)
+{
+	void *p;
+	if (posix_memalign(&p, KB_NODE_ALIGN, len) != 0) return 0;
+	return (kbnode_t*)memset(p, 0, len);
+}
+
 #define __KB_TREE_T(name)						\
 	typedef struct {							\
 		kbnode_t *root;							\
@@ -58,7 +72,8 @@ typedef struct {
 		int	n_keys, n_nodes;					\
 	} kbtree_##name##_t;
 
-#define __KB_INIT(name, key_t)											\
+/* pad: number of bytes the node search may read past the last key */
+#define __KB_INIT(name, key_t, pad)										\
 	kbtree_##name##_t *kb_init_##name(int size)							\
 	{																	\
 		kbtree_##name##_t *b;											\
@@ -69,9 +84,12 @@ typedef struct {
 		}																\
 		b->n = 2 * b->t - 1;											\
 		b->off_ptr = 4 + b->n * sizeof(key_t);							\
-		b->ilen = (4 + sizeof(void*) + b->n * (sizeof(void*) + sizeof(key_t)) + 3) >> 2 << 2; \
-		b->elen = (b->off_ptr + 3) >> 2 << 2;							\
-		b->root = (kbnode_t*)calloc(1, b->ilen);						\
+		b->ilen = 4 + sizeof(void*) + b->n * (sizeof(void*) + sizeof(key_t)); \
+		b->elen = b->off_ptr + (pad);									\
+		if (b->ilen < b->elen) b->ilen = b->elen;						\
+		b->ilen = (b->ilen + KB_NODE_ALIGN - 1) / KB_NODE_ALIGN * KB_NODE_ALIGN; \
+		b->elen = (b->elen + KB_NODE_ALIGN - 1) / KB_NODE_ALIGN * KB_NODE_ALIGN; \
+		b->root = __kb_node_calloc(b->ilen);							\
 		++b->n_nodes;													\
 		return b;														\
 	}
@@ -116,6 +134,67 @@ typedef struct {
 		return begin;													\
 	}
 
+/* Number of leading keys smaller than k in a sorted node. Key i is the
+ * uint32_t at p + 4*s*i; s is the key size in 32-bit words. With SIMD, whole
+ * vectors are compared and lanes past the last key are masked out, so up to
+ * 32 bytes after key n-1 may be read. */
+static inline int __kb_count_lt_u32(const uint8_t *p, int n, int s, uint32_t k)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	if (s == 1 || s == 2 || s == 4) {
+		const __m256i sign = _mm256_set1_epi32(0x80000000), kv = _mm256_set1_epi32(k ^ 0x80000000U);
+		int w = 8 / s, keep = s == 1? 0xff : s == 2? 0x55 : 0x11; /* w keys per vector; keep the first word of each key */
+		for (; i < n; i += w, p += 32) {
+			__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), sign); /* for unsigned comparison */
+			int m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(kv, v))) & keep;
+			if (n - i < w) m &= (1 << (n - i) * s) - 1;
+			if (m != keep) return i + __builtin_popcount(m); /* keys are sorted; the rest are not smaller */
+		}
+		return n;
+	}
+#elif defined(__SSE2__)
+	if (s == 1 || s == 2 || s == 4) {
+		const __m128i sign = _mm_set1_epi32(0x80000000), kv = _mm_set1_epi32(k ^ 0x80000000U);
+		int w = 4 / s, keep = s == 1? 0xf : s == 2? 0x5 : 0x1;
+		for (; i < n; i += w, p += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), sign);
+			int m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(kv, v))) & keep;
+			if (n - i < w) m &= (1 << (n - i) * s) - 1;
+			if (m != keep) return i + __builtin_popcount(m);
+		}
+		return n;
+	}
+#endif
+	{ /* binary search */
+		int end = n;
+		while (i < end) {
+			int mid = (i + end) >> 1;
+			uint32_t y;
+			memcpy(&y, p + 4 * s * mid, 4);
+			if (y < k) i = mid + 1;
+			else end = mid;
+		}
+	}
+	return i;
+}
+
+/* The first 4 bytes of key_t are a uint32_t that determines the order */
+#define __KB_GET_AUX_U32(name, key_t)									\
+	static inline int __kb_getp_aux_##name(const kbnode_t * __restrict x, const key_t * __restrict k, int *r) \
+	{																	\
+		int tr, *rr, begin;												\
+		uint32_t kk, kx;												\
+		if (x->n == 0) return -1;										\
+		rr = r? r : &tr;												\
+		memcpy(&kk, k, 4);												\
+		begin = __kb_count_lt_u32((const uint8_t*)__KB_KEY(key_t, x), x->n, sizeof(key_t) >> 2, kk); \
+		if (begin == x->n) { *rr = 1; return x->n - 1; }				\
+		memcpy(&kx, &__KB_KEY(key_t, x)[begin], 4);						\
+		if ((*rr = (kk > kx) - (kk < kx)) < 0) --begin;					\
+		return begin;													\
+	}
+
 #define __KB_GET(name, key_t)											\
 	static key_t *kb_getp_##name(kbtree_##name##_t *b, const key_t * __restrict k) \
 	{																	\
@@ -162,7 +241,7 @@ typedef struct {
 	static void __kb_split_##name(kbtree_##name##_t *b, kbnode_t *x, int i, kbnode_t *y) \
 	{																	\
 		kbnode_t *z;													\
-		z = (kbnode_t*)calloc(1, y->is_internal? b->ilen : b->elen);	\
+		z = __kb_node_calloc(y->is_internal? b->ilen : b->elen);		\
 		++b->n_nodes;													\
 		z->is_internal = y->is_internal;								\
 		z->n = b->t - 1;												\
@@ -203,7 +282,7 @@ typedef struct {
 		r = b->root;													\
 		if (r->n == 2 * b->t - 1) {										\
 			++b->n_nodes;												\
-			s = (kbnode_t*)calloc(1, b->ilen);							\
+			s = __kb_node_calloc(b->ilen);								\
 			b->root = s; s->is_internal = 1; s->n = 0;					\
 			__KB_PTR(b, s)[0] = r;										\
 			__kb_split_##name(b, s, 0, r);								\
@@ -317,6 +396,39 @@ typedef struct {
 		return kb_delp_##name(b, &k);									\
 	}
 
+#define __KB_BULK(name, key_t)											\
+	/* build the tree bottom-up from n sorted distinct keys; b must be empty */ \
+	static void kb_bulk_load_##name(kbtree_##name##_t *b, size_t n, const key_t *a) \
+	{																	\
+		kbnode_t **c = 0, **d;											\
+		key_t *s = 0, *t;												\
+		const key_t *k = a;												\
+		size_t i, j, m, q, r, n_keys = n;								\
+		if (n == 0 || b->n_keys) return;								\
+		free(b->root); --b->n_nodes;									\
+		for (;;) { /* one level at a time; c and n: child nodes and keys from the level below */ \
+			m = (n + b->n + 1) / (b->n + 1); /* #nodes at this level; one key between two nodes goes up */ \
+			q = (n - m + 1) / m, r = (n - m + 1) % m; /* node j gets q keys, plus one if j < r */ \
+			d = (kbnode_t**)malloc(m * sizeof(kbnode_t*));				\
+			t = m > 1? (key_t*)malloc((m - 1) * sizeof(key_t)) : 0;		\
+			for (i = j = 0; j < m; ++j) {								\
+				int l = q + (j < r);									\
+				kbnode_t *x = __kb_node_calloc(c? b->ilen : b->elen);	\
+				x->is_internal = c? 1 : 0, x->n = l;					\
+				memcpy(__KB_KEY(key_t, x), k + i, l * sizeof(key_t));	\
+				if (c) memcpy(__KB_PTR(b, x), c + i, (l + 1) * sizeof(kbnode_t*)); \
+				d[j] = x, i += l;										\
+				if (j < m - 1) t[j] = k[i++];							\
+			}															\
+			b->n_nodes += m;											\
+			free(c); free(s);											\
+			if (m == 1) break;											\
+			c = d, k = s = t, n = m - 1;								\
+		}																\
+		b->root = d[0], b->n_keys = n_keys;								\
+		free(d);														\
+	}
+
 #define __KB_ITR(name, key_t) \
 	static inline void kb_itr_first_##name(kbtree_##name##_t *b, kbitr_t *itr) \
 	{ \
@@ -330,17 +442,18 @@ typedef struct {
 			itr->p->x = __KB_PTR(b, x)[0]; itr->p->i = 0; \
 		} \
 	} \
-	static int kb_itr_get_##name(kbtree_##name##_t *b, const key_t * __restrict k, kbitr_t *itr) \
+	/* on a miss, kb_itr_next() moves the iterator to the first key greater than k */ \
+	static inline int kb_itr_get_##name(kbtree_##name##_t *b, const key_t * __restrict k, kbitr_t *itr) \
 	{ \
 		int i, r = 0; \
 		itr->p = itr->stack; \
-		itr->p->x = b->root; itr->p->i = 0; \
+		itr->p->x = b->root; \
 		while (itr->p->x) { \
 			i = __kb_getp_aux_##name(itr->p->x, k, &r); \
+			itr->p->i = i; \
 			if (i >= 0 && r == 0) return 0; \
-			if (itr->p->x->is_internal == 0) return -1; \
-			itr->p[1].x = __KB_PTR(b, itr->p->x)[i + 1]; \
-			itr->p[1].i = i; \
+			++itr->p->i; \
+			itr->p[1].x = itr->p->x->is_internal? __KB_PTR(b, itr->p->x)[i + 1] : 0; \
 			++itr->p; \
 		} \
 		return -1; \
@@ -363,12 +476,27 @@ typedef struct {
 
 #define KBTREE_INIT(name, key_t, __cmp)			\
 	__KB_TREE_T(name)							\
-	__KB_INIT(name, key_t)						\
+	__KB_INIT(name, key_t, 0)					\
 	__KB_GET_AUX1(name, key_t, __cmp)			\
 	__KB_GET(name, key_t)						\
 	__KB_INTERVAL(name, key_t)					\
 	__KB_PUT(name, key_t, __cmp)				\
 	__KB_DEL(name, key_t) \
+	__KB_BULK(name, key_t)						\
+	__KB_ITR(name, key_t)
+
+/* For key_t starting with a uint32_t that __cmp compares as unsigned (e.g. a
+ * plain uint32_t, or a struct with the key as its first member). Nodes are
+ * searched with SIMD comparisons if the key size is 4, 8 or 16 bytes. */
+#define KBTREE_INIT_U32(name, key_t, __cmp)		\
+	__KB_TREE_T(name)							\
+	__KB_INIT(name, key_t, 32)					\
+	__KB_GET_AUX_U32(name, key_t)				\
+	__KB_GET(name, key_t)						\
+	__KB_INTERVAL(name, key_t)					\
+	__KB_PUT(name, key_t, __cmp)				\
+	__KB_DEL(name, key_t) \
+	__KB_BULK(name, key_t)						\
 	__KB_ITR(name, key_t)
 
 #define KB_DEFAULT_SIZE 512
@@ -384,6 +512,7 @@ typedef struct {
 #define kb_putp(name, b, k) kb_putp_##name(b, k)
 #define kb_delp(name, b, k) kb_delp_##name(b, k)
 #define kb_intervalp(name, b, k, l, u) kb_intervalp_##name(b, k, l, u)
+#define kb_bulk_load(name, b, n, a) kb_bulk_load_##name(b, n, a)
 
 #define kb_itr_first(name, b, i) kb_itr_first_##name(b, i)
 #define kb_itr_get(name, b, k, i) kb_itr_get_##name(b, k, i)
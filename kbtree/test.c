@@ -1,3 +1,5 @@
+#define UDB_TEST_LOOKUP
+#define UDB_TEST_RANGE
 #include "../common.c"
 #include "kbtree.h"
 
@@ -6,7 +8,13 @@ typedef struct aux_s {
 } aux_t;
 
 #define aux_cmp(a, b) (((a).key > (b).key) - ((a).key < (b).key))
+#ifdef USE_SIMD
+KBTREE_INIT_U32(32, aux_t, aux_cmp)
+#else
 KBTREE_INIT(32, aux_t, aux_cmp)
+#endif
+
+#define NODE_SIZE (udb_node_size? udb_node_size : KB_DEFAULT_SIZE)
 
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
@@ -14,12 +22,12 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 	uint32_t i, n, j;
 	uint64_t z = 0, x = x0;
 	kbtree_t(32) *h;
-	h = kb_init(32, KB_DEFAULT_SIZE);
+	h = kb_init(32, NODE_SIZE);
 	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
 		for (; i < n; ++i) {
 			aux_t a, *p;
 			uint64_t y = udb_splitmix64(&x);
-			a.key = udb_get_key(n, y), a.cnt = 1;
+			a.key = udb_get_key(n, y), a.cnt = is_del? i : 1;
 			p = kb_getp(32, h, &a);
 			if (is_del) {
 				if (p == 0) {
@@ -33,7 +41,66 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				} else z += ++p->cnt;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			kbitr_t itr;
+			for (kb_itr_first(32, h, &itr); kb_itr_valid(&itr); kb_itr_next(32, h, &itr))
+				s += kb_itr_key(aux_t, &itr).cnt;
+			udb_scan_end(s);
+		}
 		udb_measure(n, kb_size(h), z, &cp[j]);
 	}
 	kb_destroy(32, h);
 }
+
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp)
+{
+	uint32_t i;
+	uint64_t z = 0, x = x0;
+	kbtree_t(32) *h;
+	h = kb_init(32, NODE_SIZE);
+	for (i = 0; i < N; ++i) {
+		aux_t a, *p;
+		a.key = udb_build_key(i), a.cnt = i;
+		p = kb_getp(32, h, &a);
+		if (p == 0) kb_putp(32, h, &a);
+		else p->cnt = i;
+	}
+	udb_measure(N, kb_size(h), 0, &cp[0]);
+	for (i = 0; i < n_q; ++i) {
+		aux_t a, *p;
+		a.key = udb_lookup_key(N, hit, udb_splitmix64(&x));
+		p = kb_getp(32, h, &a);
+		if (p) z += p->cnt + 1;
+	}
+	udb_measure(n_q, kb_size(h), z, &cp[1]);
+	kb_destroy(32, h);
+}
+
+uint64_t test_range(uint32_t n, const uint32_t *a, uint32_t n_q, uint32_t len, uint32_t x0, udb_checkpoint_t *cp)
+{
+	uint32_t i;
+	uint64_t z = 0, n_vis = 0, x = x0;
+	aux_t *b;
+	kbtree_t(32) *h;
+	b = (aux_t*)malloc(n * sizeof(aux_t));
+	for (i = 0; i < n; ++i) b[i].key = a[i], b[i].cnt = i;
+	h = kb_init(32, NODE_SIZE);
+	kb_bulk_load(32, h, n, b);
+	free(b);
+	udb_measure(n, kb_size(h), 0, &cp[0]);
+	for (i = 0; i < n_q; ++i) {
+		kbitr_t itr;
+		aux_t q;
+		uint32_t l;
+		int ok;
+		q.key = udb_range_key(&x);
+		ok = kb_itr_get(32, h, &q, &itr) == 0 || kb_itr_next(32, h, &itr); // the first key >= q
+		for (l = 0; ok && l < len; ++l, ok = kb_itr_next(32, h, &itr))
+			z += kb_itr_key(aux_t, &itr).cnt;
+		n_vis += l;
+	}
+	udb_measure(n_q, kb_size(h), z, &cp[1]);
+	kb_destroy(32, h);
+	return n_vis;
+}
@@ -0,0 +1,229 @@
+/* The MIT License
+
+   Copyright (c) 2024- by Attractive Chaos <attractor@live.co.uk>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+#ifndef __AC_KHASHE_BG_H
+#define __AC_KHASHE_BG_H
+
+#include <pthread.h>
+#include "khashl.h"
+
+/* Ensemble whose sub-tables grow in a helper thread. The caller thread is
+ * the only one that inserts or deletes; the helper only migrates buckets.
+ *
+ * Sub-tables use incremental rehashing (KHASHL_INCR_INIT). Once a sub-table
+ * passes kh_bg_high(), put() starts a migration, which only allocates the new
+ * arrays and swaps pointers, and queues the sub-table for the helper. The
+ * helper moves kh_bg_chunk old buckets at a time under a per-sub-table
+ * spinlock; the caller takes that lock only for sub-tables being migrated.
+ * If a sub-table reaches kh_max_count() before the helper is done, put()
+ * finishes the migration synchronously as KHASHL_INCR_INIT does.
+ *
+ * A position returned by put()/get() always points to the new array, which
+ * the helper never rearranges, so the caller may write the value without the
+ * lock. Call prefix_finish() before iterating with kh_ens_foreach(). Peak
+ * memory is that of KHASHL_INCR_INIT: old and new arrays coexist. */
+
+#ifndef kh_bg_high /* start growing a sub-table in the background at this count */
+#define kh_bg_high(cap) (kh_max_count(cap) - ((cap)>>4)) /* 68.75% with the default 75% max load */
+#endif
+
+#ifndef kh_bg_chunk /* the number of old buckets the helper migrates per lock */
+#define kh_bg_chunk 4096
+#endif
+
+#define KHASHE_BG_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	KHASHL_INCR_INIT(KH_LOCAL, HType##_sub, prefix##_sub, khkey_t, __hash_fn, __hash_eq) \
+	typedef union { \
+		struct { int lock, busy; } s; /* busy is set by the caller and cleared by the helper */ \
+		char pad[64]; /* avoid false sharing between locks */ \
+	} HType##_bgctl; \
+	typedef struct HType { \
+		void *km, *mem; \
+		khint64_t count:54, bits:8; \
+		HType##_sub *sub; \
+		HType##_bgctl *ctl; /* aligned to 64 bytes */ \
+		khint_t *q, q_beg, q_end; /* sub-tables waiting for the helper; at most one entry each */ \
+		int quit; \
+		pthread_t tid; \
+		pthread_mutex_t mtx; \
+		pthread_cond_t cv; \
+	} HType; \
+	static void *prefix##_bg_worker(void *data) { \
+		HType *g = (HType*)data; \
+		khint_t t, mask = (1U<<g->bits) - 1; \
+		int done; \
+		while (1) { \
+			pthread_mutex_lock(&g->mtx); \
+			while (g->q_beg == g->q_end && !g->quit) \
+				pthread_cond_wait(&g->cv, &g->mtx); \
+			if (g->q_beg == g->q_end) { /* quit after draining the queue */ \
+				pthread_mutex_unlock(&g->mtx); \
+				break; \
+			} \
+			t = g->q[g->q_beg++ & mask]; \
+			pthread_mutex_unlock(&g->mtx); \
+			do { \
+				__kh_spin_lock(&g->ctl[t].s.lock); \
+				prefix##_sub_migrate(&g->sub[t], kh_bg_chunk); \
+				done = (g->sub[t].old_keys == 0); \
+				if (done) __atomic_store_n(&g->ctl[t].s.busy, 0, __ATOMIC_RELEASE); \
+				__kh_spin_unlock(&g->ctl[t].s.lock); \
+			} while (!done); \
+		} \
+		return 0; \
+	} \
+	SCOPE HType *prefix##_init2(void *km, int bits) { \
+		HType *g; \
+		g = Kcalloc(km, HType, 1); \
+		g->bits = bits, g->km = km; \
+		g->sub = Kcalloc(km, HType##_sub, 1U<<bits); \
+		g->mem = Kcalloc(km, char, ((size_t)sizeof(HType##_bgctl) << bits) + 63); \
+		g->ctl = (HType##_bgctl*)(((size_t)g->mem + 63) & ~(size_t)63); \
+		g->q = Kcalloc(km, khint_t, 1U<<bits); \
+		pthread_mutex_init(&g->mtx, 0); \
+		pthread_cond_init(&g->cv, 0); \
+		if (pthread_create(&g->tid, 0, prefix##_bg_worker, g) != 0) g->quit = 2; /* no helper; grow synchronously */ \
+		return g; \
+	} \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_init2(0, bits); } \
+	SCOPE void prefix##_destroy(HType *g) { \
+		int t; \
+		if (!g) return; \
+		if (g->quit == 0) { \
+			pthread_mutex_lock(&g->mtx); \
+			g->quit = 1; \
+			pthread_cond_signal(&g->cv); \
+			pthread_mutex_unlock(&g->mtx); \
+			pthread_join(g->tid, 0); \
+		} \
+		pthread_mutex_destroy(&g->mtx); \
+		pthread_cond_destroy(&g->cv); \
+		for (t = 0; t < 1<<g->bits; ++t) { \
+			Kfree(g->km, (void*)g->sub[t].old_keys); Kfree(g->km, g->sub[t].old_used); \
+			Kfree(g->km, (void*)g->sub[t].keys); Kfree(g->km, g->sub[t].used); \
+		} \
+		Kfree(g->km, g->q); Kfree(g->km, g->mem); \
+		Kfree(g->km, g->sub); Kfree(g->km, g); \
+	} \
+	static void prefix##_bg_start(HType *g, khint_t t) { /* only called when the helper does not own sub-table t */ \
+		HType##_sub *h = &g->sub[t]; \
+		if (prefix##_sub_resize(h, kh_capacity(h) + 1U) < 0 || h->old_keys == 0) return; /* nothing to migrate */ \
+		__atomic_store_n(&g->ctl[t].s.busy, 1, __ATOMIC_RELEASE); \
+		pthread_mutex_lock(&g->mtx); \
+		g->q[g->q_end++ & ((1U<<g->bits) - 1)] = t; \
+		pthread_cond_signal(&g->cv); \
+		pthread_mutex_unlock(&g->mtx); \
+	} \
+	SCOPE void prefix##_finish(HType *g) { /* complete all migrations; required before iteration */ \
+		khint_t t; \
+		for (t = 0; t < 1U<<g->bits; ++t) { \
+			if (!__atomic_load_n(&g->ctl[t].s.busy, __ATOMIC_ACQUIRE)) continue; \
+			__kh_spin_lock(&g->ctl[t].s.lock); \
+			prefix##_sub_finish(&g->sub[t]); \
+			__kh_spin_unlock(&g->ctl[t].s.lock); \
+			while (__atomic_load_n(&g->ctl[t].s.busy, __ATOMIC_ACQUIRE)) /* the helper clears busy once it gets there */ \
+				__kh_yield(); \
+		} \
+	} \
+	SCOPE kh_ensitr_t prefix##_getp(HType *g, const khkey_t *key) { \
+		khint_t hash, low, ret; \
+		kh_ensitr_t r; \
+		HType##_sub *h; \
+		hash = __hash_fn(*key); \
+		low = hash & ((1U<<g->bits) - 1); \
+		h = &g->sub[low]; \
+		if (__atomic_load_n(&g->ctl[low].s.busy, __ATOMIC_ACQUIRE)) { /* get() may move a key out of the old array */ \
+			__kh_spin_lock(&g->ctl[low].s.lock); \
+			ret = prefix##_sub_getp_core(h, key, hash); \
+			__kh_spin_unlock(&g->ctl[low].s.lock); \
+		} else ret = prefix##_sub_getp_core(h, key, hash); \
+		r.sub = low, r.pos = ret == kh_end(h)? (khint_t)-1 : ret; \
+		return r; \
+	} \
+	SCOPE kh_ensitr_t prefix##_get(HType *g, const khkey_t key) { return prefix##_getp(g, &key); } \
+	SCOPE kh_ensitr_t prefix##_putp(HType *g, const khkey_t *key, int *absent) { \
+		khint_t hash, low, ret; \
+		kh_ensitr_t r; \
+		HType##_sub *h; \
+		hash = __hash_fn(*key); \
+		low = hash & ((1U<<g->bits) - 1); \
+		h = &g->sub[low]; \
+		if (!g->quit && !__atomic_load_n(&g->ctl[low].s.busy, __ATOMIC_ACQUIRE) && h->keys && h->count >= kh_bg_high(kh_capacity(h))) \
+			prefix##_bg_start(g, low); /* before put(): starting a migration moves the existing keys */ \
+		if (__atomic_load_n(&g->ctl[low].s.busy, __ATOMIC_ACQUIRE)) { \
+			__kh_spin_lock(&g->ctl[low].s.lock); \
+			ret = prefix##_sub_putp_core(h, key, hash, absent); \
+			__kh_spin_unlock(&g->ctl[low].s.lock); \
+		} else ret = prefix##_sub_putp_core(h, key, hash, absent); \
+		if (*absent > 0) ++g->count; \
+		r.sub = low, r.pos = ret; \
+		return r; \
+	} \
+	SCOPE kh_ensitr_t prefix##_put(HType *g, const khkey_t key, int *absent) { return prefix##_putp(g, &key, absent); } \
+	SCOPE int prefix##_del(HType *g, kh_ensitr_t itr) { \
+		HType##_sub *h = &g->sub[itr.sub]; \
+		int ret; \
+		if (__atomic_load_n(&g->ctl[itr.sub].s.busy, __ATOMIC_ACQUIRE)) { \
+			__kh_spin_lock(&g->ctl[itr.sub].s.lock); \
+			ret = prefix##_sub_del(h, itr.pos); \
+			__kh_spin_unlock(&g->ctl[itr.sub].s.lock); \
+		} else ret = prefix##_sub_del(h, itr.pos); \
+		if (ret) --g->count; \
+		return ret; \
+	} \
+	SCOPE void prefix##_clear(HType *g) { \
+		int i; \
+		prefix##_finish(g); \
+		for (i = 0; i < 1U<<g->bits; ++i) prefix##_sub_clear(&g->sub[i]); \
+		g->count = 0; \
+	}
+
+#define KHASHE_BG_SET_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; } kh_packed HType##_bs_bucket_t; \
+	static kh_inline khint_t prefix##_bs_hash(HType##_bs_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_bs_eq(HType##_bs_bucket_t x, HType##_bs_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHE_BG_INIT(KH_LOCAL, HType, prefix##_bs, HType##_bs_bucket_t, prefix##_bs_hash, prefix##_bs_eq) \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_bs_init(bits); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_bs_destroy(h); } \
+	SCOPE void prefix##_finish(HType *h) { prefix##_bs_finish(h); } \
+	SCOPE kh_ensitr_t prefix##_get(HType *h, khkey_t key) { HType##_bs_bucket_t t; t.key = key; return prefix##_bs_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, kh_ensitr_t k) { return prefix##_bs_del(h, k); } \
+	SCOPE kh_ensitr_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_bs_bucket_t t; t.key = key; return prefix##_bs_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_bs_clear(h); }
+
+#define KHASHE_BG_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; kh_val_t val; } kh_packed HType##_bm_bucket_t; \
+	static kh_inline khint_t prefix##_bm_hash(HType##_bm_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_bm_eq(HType##_bm_bucket_t x, HType##_bm_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHE_BG_INIT(KH_LOCAL, HType, prefix##_bm, HType##_bm_bucket_t, prefix##_bm_hash, prefix##_bm_eq) \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_bm_init(bits); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_bm_destroy(h); } \
+	SCOPE void prefix##_finish(HType *h) { prefix##_bm_finish(h); } \
+	SCOPE kh_ensitr_t prefix##_get(HType *h, khkey_t key) { HType##_bm_bucket_t t; t.key = key; return prefix##_bm_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, kh_ensitr_t k) { return prefix##_bm_del(h, k); } \
+	SCOPE kh_ensitr_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_bm_bucket_t t; t.key = key; return prefix##_bm_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_bm_clear(h); }
+
+#endif
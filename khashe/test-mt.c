@@ -0,0 +1,81 @@
+#define UDB_TEST_MT
+#include "../common.c"
+#include "khashl.h"
+
+KHASHE_MT_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+
+typedef struct {
+	uint32_t i;
+	uint64_t z;
+} opdata_t;
+
+static int op_inc(uint32_t *val, int absent, void *data)
+{
+	opdata_t *d = (opdata_t*)data;
+	if (absent) *val = 0;
+	d->z += ++*val;
+	return 0;
+}
+
+static int op_toggle(uint32_t *val, int absent, void *data) // insert if absent; delete otherwise
+{
+	opdata_t *d = (opdata_t*)data;
+	if (!absent) return 1;
+	*val = d->i, ++d->z;
+	return 0;
+}
+
+void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t n, j;
+	uint64_t x = x0;
+	opdata_t d;
+	intmap_t *h = intmap_init(6);
+	d.z = 0;
+	for (j = 0, d.i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; d.i < n; ++d.i) {
+			uint64_t y = udb_splitmix64(&x);
+			intmap_update_fn(h, udb_get_key(n, y), is_del? op_toggle : op_inc, &d);
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			khint_t k;
+			int t;
+			for (t = 0; t < 1<<h->bits; ++t)
+				kh_foreach(&h->sub[t].s.h, k) s += kh_val(&h->sub[t].s.h, k);
+			udb_scan_end(s);
+		}
+		udb_measure(n, kh_ens_size(h), d.z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
+
+static void *worker_int(void *data) // all threads share one table
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	intmap_t *h = (intmap_t*)a->h;
+	opdata_t d;
+	size_t j;
+	d.z = 0;
+	for (j = 0; j < a->n_key; ++j) {
+		d.i = a->key[j].i;
+		intmap_update_fn(h, a->key[j].key, a->is_del? op_toggle : op_inc, &d);
+	}
+	a->z += d.z;
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	intmap_t *h = intmap_init(6);
+	udb_mtarg_t *a = udb_mt_init(n_threads, is_del, x0, h);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		udb_mt_step(a, i, n, UDB_MT_SLICE, worker_int);
+		udb_measure(n, kh_ens_size(h), udb_mt_checksum(a), &cp[j]);
+	}
+	intmap_destroy(h);
+	free(a);
+}
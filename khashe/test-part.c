@@ -0,0 +1,131 @@
+#define UDB_TEST_MT
+#include "../common.c"
+#include "khashl.h"
+
+KHASHE_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+
+#define ENS_BITS 6
+
+void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	intmap_t *h = intmap_init(ENS_BITS);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			kh_ensitr_t k;
+			int absent;
+			uint64_t y = udb_splitmix64(&x);
+			k = intmap_put(h, udb_get_key(n, y), &absent);
+			if (is_del) {
+				if (absent) kh_ens_val(h, k) = i, ++z;
+				else intmap_del(h, k);
+			} else {
+				if (absent) kh_ens_val(h, k) = 0;
+				z += ++kh_ens_val(h, k);
+			}
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			kh_ensitr_t k;
+			kh_ens_foreach(h, k) s += kh_ens_val(h, k);
+			udb_scan_end(s);
+		}
+		udb_measure(n, kh_ens_size(h), z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
+
+/* Two phases per checkpoint. In the partition phase, thread p takes its
+ * slice of the inputs and appends each key to buffer (p,t), where worker t
+ * owns the sub-table selected by the low hash bits, as in KHASHE_INIT. In the
+ * insertion phase, worker t drains buffers (0,t), (1,t), ... in order. Thread
+ * p takes earlier inputs than thread p+1, so each key sees its operations in
+ * the single-threaded order and no locks are needed. */
+
+typedef struct {
+	intmap_t *h;
+	int n_threads;
+	size_t *n, *m;       // size and capacity of each buffer
+	udb_mtkey_t **buf;    // buf[p*n_threads+t]: keys from producer p for worker t
+} part_t;
+
+static inline int part_owner(uint32_t key, int n_threads) // sub-tables [t*64/n_threads, (t+1)*64/n_threads) go to worker t
+{
+	khint_t sub = (khint_t)udb_hash_fn(key) & ((1U<<ENS_BITS) - 1);
+	return (int)(sub * n_threads >> ENS_BITS);
+}
+
+static void *worker_part(void *data)
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	part_t *P = (part_t*)a->h;
+	size_t j;
+	int t;
+	for (t = 0; t < P->n_threads; ++t)
+		P->n[a->tid * P->n_threads + t] = 0;
+	for (j = 0; j < a->n_key; ++j) {
+		int b = a->tid * P->n_threads + part_owner(a->key[j].key, P->n_threads);
+		if (P->n[b] == P->m[b]) {
+			P->m[b] += (P->m[b]>>1) + 16;
+			P->buf[b] = (udb_mtkey_t*)realloc(P->buf[b], P->m[b] * sizeof(udb_mtkey_t));
+		}
+		P->buf[b][P->n[b]++] = a->key[j];
+	}
+	return 0;
+}
+
+static void *worker_ins(void *data)
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	part_t *P = (part_t*)a->h;
+	int p;
+	for (p = 0; p < P->n_threads; ++p) {
+		int b = p * P->n_threads + a->tid;
+		const udb_mtkey_t *q = P->buf[b];
+		size_t j;
+		for (j = 0; j < P->n[b]; ++j) {
+			intmap_t_em_bucket_t t;
+			intmap_t_sub *s;
+			khint_t hash, k;
+			int absent;
+			t.key = q[j].key;
+			hash = (khint_t)udb_hash_fn(t.key);
+			s = &P->h->sub[hash & ((1U<<ENS_BITS) - 1)]; // owned by this worker only
+			k = intmap_em_sub_putp_core(s, &t, hash, &absent);
+			if (a->is_del) {
+				if (absent) kh_val(s, k) = q[j].i, ++a->z, ++a->cnt;
+				else intmap_em_sub_del(s, k), --a->cnt;
+			} else {
+				if (absent) kh_val(s, k) = 0, ++a->cnt;
+				a->z += ++kh_val(s, k);
+			}
+		}
+	}
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	part_t P;
+	udb_mtarg_t *a;
+	int b;
+	P.h = intmap_init(ENS_BITS);
+	P.n_threads = n_threads;
+	P.n = (size_t*)calloc(n_threads * n_threads, sizeof(size_t));
+	P.m = (size_t*)calloc(n_threads * n_threads, sizeof(size_t));
+	P.buf = (udb_mtkey_t**)calloc(n_threads * n_threads, sizeof(udb_mtkey_t*));
+	a = udb_mt_init(n_threads, is_del, x0, &P);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		udb_mt_step(a, i, n, UDB_MT_SLICE, worker_part);
+		udb_mt_step(a, i, n, UDB_MT_NOKEY, worker_ins);
+		P.h->count = udb_mt_count(a); // the sub-table functions do not update the ensemble count
+		udb_measure(n, kh_ens_size(P.h), udb_mt_checksum(a), &cp[j]);
+	}
+	intmap_destroy(P.h);
+	for (b = 0; b < n_threads * n_threads; ++b) free(P.buf[b]);
+	free(P.buf); free(P.n); free(P.m); free(a);
+}
@@ -1,7 +1,17 @@
+#define UDB_TEST_MIX
+#define UDB_TEST_MT
+#define UDB_TEST_LAT
 #include "../common.c"
+#ifdef USE_SHRINK
+#define kh_min_count(cap) ((cap)>>3) /* halve the table below 12.5% load */
+#endif
+#ifdef USE_BG
+#include "khashe_bg.h"
+KHASHE_BG_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+#else
 #include "khashl.h"
-
 KHASHE_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+#endif
 
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
@@ -9,11 +19,18 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 	uint32_t i, n, j;
 	uint64_t z = 0, x = x0;
 	intmap_t *h = intmap_init(6);
+	khint_t *cap = 0; // capacity of each sub-table; only tracked when sampling latencies
+	if (udb_lat.k) {
+		cap = (khint_t*)malloc((1U<<h->bits) * sizeof(khint_t));
+		for (i = 0; i < 1U<<h->bits; ++i)
+			cap[i] = kh_capacity(&h->sub[i]);
+	}
 	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
 		for (; i < n; ++i) {
 			kh_ensitr_t k;
 			int absent;
 			uint64_t y = udb_splitmix64(&x);
+			udb_lat_begin();
 			k = intmap_put(h, udb_get_key(n, y), &absent);
 			if (is_del) {
 				if (absent) kh_ens_val(h, k) = i, ++z;
@@ -22,8 +39,101 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				if (absent) kh_ens_val(h, k) = 0;
 				z += ++kh_ens_val(h, k);
 			}
+			if (udb_lat.k) { // only sub-table k.sub may have been resized
+				khint_t c = kh_capacity(&h->sub[k.sub]);
+				udb_lat_end(c != cap[k.sub]);
+				cap[k.sub] = c;
+			}
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			kh_ensitr_t k;
+#ifdef USE_BG
+			intmap_finish(h);
+#endif
+			kh_ens_foreach(h, k) s += kh_ens_val(h, k);
+			udb_scan_end(s);
 		}
 		udb_measure(n, kh_ens_size(h), z, &cp[j]);
 	}
 	intmap_destroy(h);
+	free(cap);
+}
+
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp) // with -DUSE_SHRINK, a delete-heavy mix shrinks the sub-tables
+{
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	intmap_t *h = intmap_init(6);
+	for (i = 0; i < n0; ++i) {
+		int absent;
+		kh_ensitr_t k = intmap_put(h, udb_build_key(i), &absent);
+		kh_ens_val(h, k) = i;
+	}
+	udb_measure(0, kh_ens_size(h), 0, &cp[0]);
+	for (j = 1, i = 0; j <= n_cp; ++j) {
+		n = (uint64_t)N * j / n_cp;
+		for (; i < n; ++i) {
+			uint32_t key;
+			int absent, c = udb_mix_next(udb_splitmix64(&x), &key);
+			kh_ensitr_t k;
+			if (c == UDB_MIX_INSERT) {
+				k = intmap_put(h, key, &absent);
+				kh_ens_val(h, k) = i, ++z;
+			} else {
+				k = intmap_get(h, key);
+				if (!kh_ens_is_end(k)) {
+					if (c == UDB_MIX_READ) z += kh_ens_val(h, k);
+					else if (c == UDB_MIX_UPDATE) z += ++kh_ens_val(h, k);
+					else intmap_del(h, k), ++z;
+				}
+			}
+			udb_mix_end(c);
+		}
+		udb_measure(n, kh_ens_size(h), z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
+
+static void *worker_int(void *data) // each thread owns a separate ensemble
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	intmap_t *h = ((intmap_t**)a->h)[a->tid];
+	size_t j;
+	for (j = 0; j < a->n_key; ++j) { // the keys owned by this thread
+		kh_ensitr_t k;
+		int absent;
+		k = intmap_put(h, a->key[j].key, &absent);
+		if (a->is_del) {
+			if (absent) kh_ens_val(h, k) = a->key[j].i, ++a->z;
+			else intmap_del(h, k);
+		} else {
+			if (absent) kh_ens_val(h, k) = 0;
+			a->z += ++kh_ens_val(h, k);
+		}
+	}
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	int t;
+	intmap_t **h;
+	udb_mtarg_t *a;
+	h = (intmap_t**)calloc(n_threads, sizeof(*h));
+	for (t = 0; t < n_threads; ++t)
+		h[t] = intmap_init(6);
+	a = udb_mt_init(n_threads, is_del, x0, h);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		uint32_t size = 0;
+		udb_mt_step(a, i, n, UDB_MT_OWNER, worker_int);
+		for (t = 0; t < n_threads; ++t)
+			size += kh_ens_size(h[t]);
+		udb_measure(n, size, udb_mt_checksum(a), &cp[j]);
+	}
+	for (t = 0; t < n_threads; ++t)
+		intmap_destroy(h[t]);
+	free(h); free(a);
 }
@@ -77,6 +77,18 @@ typedef const char *kh_cstr_t;
 #define kh_max_count(cap) (((cap)>>1) + ((cap)>>2)) /* default load factor: 75% */
 #endif
 
+#ifndef kh_min_count /* halve the table in del() when the count drops below this; 0 to never shrink */
+#define kh_min_count(cap) 0 /* off by default: shrinking moves elements, which breaks del() inside kh_foreach() */
+#endif
+
+#ifndef kh_mig_step /* the number of old buckets to migrate per operation in incremental rehashing */
+#define kh_mig_step 4
+#endif
+
+#ifndef kh_batch_win /* the number of keys hashed and prefetched ahead in batch operations */
+#define kh_batch_win 16
+#endif
+
 #ifndef kh_packed /* pack the key-value struct */
 #define kh_packed __attribute__ ((__packed__))
 #endif
@@ -98,6 +110,35 @@ typedef const char *kh_cstr_t;
 
 #define __kh_fsize(m) ((m) < 32? 1 : (m)>>5)
 
+static kh_inline khint_t __kh_ctz32(khint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(x);
+#else
+	khint_t r = 0;
+	for (; (x & 1) == 0; x >>= 1) ++r;
+	return r;
+#endif
+}
+
+static kh_inline khint_t __kh_used_next(const khint32_t *flag, khint_t i, khint_t n) { /* first occupied bucket in [i,n), or n; skips empty words */
+	khint_t j = i >> 5, m = __kh_fsize(n);
+	khint32_t w;
+	if (i >= n) return n;
+	w = flag[j] & (0xffffffffU << (i & 0x1fU));
+	while (w == 0) {
+		if (++j == m) return n;
+		w = flag[j];
+	}
+	i = j << 5 | __kh_ctz32(w);
+	return i < n? i : n;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __kh_prefetch(p) __builtin_prefetch(p)
+#else
+#define __kh_prefetch(p)
+#endif
+
 static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 2654435769U >> (32 - bits); } /* Fibonacci hashing */
 
 /*******************
@@ -119,6 +160,7 @@ static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 26
 	extern void prefix##_clear(HType *h); \
 	extern khint_t prefix##_getp(const HType *h, const khkey_t *key); \
 	extern int prefix##_resize(HType *h, khint_t new_n_buckets); \
+	extern int prefix##_shrink_to_fit(HType *h); \
 	extern khint_t prefix##_putp(HType *h, const khkey_t *key, int *absent); \
 	extern void prefix##_del(HType *h, khint_t k);
 
@@ -201,6 +243,12 @@ static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 26
 		Kfree(h->km, h->used); /* free the working space */ \
 		h->used = new_used, h->bits = new_bits; \
 		return 0; \
+	} \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { /* the smallest table that holds h->count without triggering a resize */ \
+		khint_t new_n_buckets = 4; \
+		if (h->keys == 0) return 0; \
+		while (kh_max_count(new_n_buckets) <= h->count) new_n_buckets <<= 1; \
+		return new_n_buckets < (khint_t)1U<<h->bits? prefix##_resize(h, new_n_buckets) : 0; \
 	}
 
 #define __KHASHL_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
@@ -212,7 +260,7 @@ static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 26
 			if (prefix##_resize(h, n_buckets + 1U) < 0) \
 				return n_buckets; \
 			n_buckets = (khint_t)1U<<h->bits; \
-		} /* TODO: to implement automatically shrinking; resize() already support shrinking */ \
+		} /* shrinking happens in del(); see kh_min_count() */ \
 		mask = n_buckets - 1; \
 		i = last = __kh_h2b(hash, h->bits); \
 		while (__kh_used(h->used, i) && !__hash_eq(h->keys[i], *key)) { \
@@ -248,6 +296,54 @@ static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 26
 		return 1; \
 	}
 
+#define __KHASHL_IMPL_BATCH(SCOPE, HType, prefix, khkey_t, __hash_fn) \
+	static kh_inline khint_t prefix##_hash_prefetch(const HType *h, const khkey_t *key) { \
+		khint_t hash = __hash_fn(*key), i = __kh_h2b(hash, h->bits); \
+		__kh_prefetch(&h->used[i>>5]); \
+		__kh_prefetch(&h->keys[i]); \
+		return hash; \
+	} \
+	SCOPE int prefix##_batch_grow(HType *h, khint_t n) { /* grow first such that no resize happens in the middle of a batch; put() resizes at count >= kh_max_count() even for a present key */ \
+		khint_t n_buckets = h->keys? (khint_t)1U<<h->bits : 0U; \
+		if (h->count + n >= kh_max_count(n_buckets)) { \
+			khint_t new_n_buckets = n_buckets > 4? n_buckets : 4; \
+			while (kh_max_count(new_n_buckets) <= h->count + n) new_n_buckets <<= 1; \
+			if (prefix##_resize(h, new_n_buckets) < 0) return -1; \
+		} \
+		return 0; \
+	} \
+	SCOPE void prefix##_get_batch(const HType *h, khint_t n, const khkey_t *keys, khint_t *idx) { \
+		khint_t i, hash[kh_batch_win]; \
+		if (h->keys == 0) { \
+			for (i = 0; i < n; ++i) idx[i] = 0; \
+			return; \
+		} \
+		for (i = 0; i < n && i < kh_batch_win; ++i) \
+			hash[i] = prefix##_hash_prefetch(h, &keys[i]); \
+		for (i = 0; i < n; ++i) { \
+			idx[i] = prefix##_getp_core(h, &keys[i], hash[i % kh_batch_win]); \
+			if (i + kh_batch_win < n) \
+				hash[i % kh_batch_win] = prefix##_hash_prefetch(h, &keys[i + kh_batch_win]); \
+		} \
+	} \
+	SCOPE int prefix##_put_batch(HType *h, khint_t n, const khkey_t *keys, khint_t *idx, int *absent) { /* positions in idx[] stay valid until the next put */ \
+		khint_t i, hash[kh_batch_win]; \
+		if (h->count + n >= kh_max_count(kh_capacity(h))) { /* may need to grow: only reserve room for the keys not present yet */ \
+			khint_t n_absent = 0; \
+			prefix##_get_batch(h, n, keys, idx); \
+			for (i = 0; i < n; ++i) n_absent += (idx[i] == kh_end(h)); \
+			if (prefix##_batch_grow(h, n_absent) < 0) return -1; \
+		} \
+		for (i = 0; i < n && i < kh_batch_win; ++i) \
+			hash[i] = prefix##_hash_prefetch(h, &keys[i]); \
+		for (i = 0; i < n; ++i) { /* resolve key i while key i+kh_batch_win is on its way */ \
+			idx[i] = prefix##_putp_core(h, &keys[i], hash[i % kh_batch_win], &absent[i]); \
+			if (i + kh_batch_win < n) \
+				hash[i % kh_batch_win] = prefix##_hash_prefetch(h, &keys[i + kh_batch_win]); \
+		} \
+		return 0; \
+	}
+
 #define KHASHL_DECLARE(HType, prefix, khkey_t) \
 	__KHASHL_TYPE(HType, khkey_t) \
 	__KHASHL_PROTOTYPES(HType, prefix, khkey_t)
@@ -258,7 +354,426 @@ static kh_inline khint_t __kh_h2b(khint_t hash, khint_t bits) { return hash * 26
 	__KHASHL_IMPL_GET(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
 	__KHASHL_IMPL_RESIZE(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
 	__KHASHL_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
-	__KHASHL_IMPL_DEL(SCOPE, HType, prefix, khkey_t, __hash_fn)
+	__KHASHL_IMPL_DEL(SCOPE, HType, prefix##_raw, khkey_t, __hash_fn) \
+	SCOPE int prefix##_del(HType *h, khint_t k) { /* with kh_min_count(), this may move other elements */ \
+		int ret = prefix##_raw_del(h, k); \
+		khint_t n_buckets = (khint_t)1U<<h->bits; \
+		if (ret && n_buckets > 4 && h->count < kh_min_count(n_buckets)) /* halve at a time: hysteresis against put() */ \
+			prefix##_resize(h, n_buckets>>1); \
+		return ret; \
+	} \
+	__KHASHL_IMPL_BATCH(SCOPE, HType, prefix, khkey_t, __hash_fn)
+
+/*****************************************************
+ * Hash table with incremental (amortized) rehashing *
+ *****************************************************/
+
+/* During a resize, the old bucket array is kept and kh_mig_step buckets
+ * are moved to the new array on each put/get/del. Old buckets below h->mig
+ * have been migrated; probing in the old array treats them as occupied and
+ * jumps over them. A key always lives in exactly one of the two arrays and a
+ * key found in the old array is moved to the new one, so the returned
+ * position always refers to h->keys. Call prefix_finish() before iterating.
+ * Peak memory is higher than the in-place resize as both arrays coexist. */
+
+#define __KHASHL_INCR_TYPE(HType, khkey_t) \
+	typedef struct HType { \
+		void *km; \
+		khint_t bits, count; \
+		khint32_t *used; \
+		khkey_t *keys; \
+		khint_t old_bits, mig; \
+		khint32_t *old_used; \
+		khkey_t *old_keys; /* non-NULL during migration */ \
+	} HType;
+
+#define __KHASHL_INCR_IMPL_BASIC(SCOPE, HType, prefix) \
+	SCOPE HType *prefix##_init2(void *km) { \
+		HType *h = Kcalloc(km, HType, 1); \
+		h->km = km; \
+		return h; \
+	} \
+	SCOPE HType *prefix##_init(void) { return prefix##_init2(0); } \
+	SCOPE void prefix##_destroy(HType *h) { \
+		if (!h) return; \
+		Kfree(h->km, (void*)h->old_keys); Kfree(h->km, h->old_used); \
+		Kfree(h->km, (void*)h->keys); Kfree(h->km, h->used); \
+		Kfree(h->km, h); \
+	} \
+	SCOPE void prefix##_clear(HType *h) { \
+		if (h && h->used) { \
+			khint_t n_buckets = (khint_t)1U << h->bits; \
+			Kfree(h->km, (void*)h->old_keys); Kfree(h->km, h->old_used); \
+			h->old_keys = 0, h->old_used = 0; \
+			memset(h->used, 0, __kh_fsize(n_buckets) * sizeof(khint32_t)); \
+			h->count = 0; \
+		} \
+	}
+
+#define __KHASHL_INCR_IMPL_MIGRATE(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	static kh_inline void prefix##_put_new(HType *h, const khkey_t *key, khint_t hash) { /* key must be absent */ \
+		khint_t i, mask = ((khint_t)1U<<h->bits) - 1U; \
+		i = __kh_h2b(hash, h->bits); \
+		while (__kh_used(h->used, i)) i = (i + 1U) & mask; \
+		h->keys[i] = *key; \
+		__kh_set_used(h->used, i); \
+	} \
+	SCOPE void prefix##_migrate(HType *h, khint_t n) { /* move up to n old buckets */ \
+		khint_t n_old, en; \
+		if (h->old_keys == 0) return; \
+		n_old = (khint_t)1U << h->old_bits; \
+		en = n_old - h->mig > n? h->mig + n : n_old; \
+		for (; h->mig < en; ++h->mig) { \
+			if (!__kh_used(h->old_used, h->mig)) continue; \
+			__kh_set_unused(h->old_used, h->mig); /* no backward shift: buckets below h->mig are skipped by probing */ \
+			prefix##_put_new(h, &h->old_keys[h->mig], __hash_fn(h->old_keys[h->mig])); \
+		} \
+		if (h->mig == n_old) { \
+			Kfree(h->km, (void*)h->old_keys); Kfree(h->km, h->old_used); \
+			h->old_keys = 0, h->old_used = 0; \
+		} \
+	} \
+	SCOPE void prefix##_finish(HType *h) { prefix##_migrate(h, (khint_t)-1); } \
+	static khint_t prefix##_old_getp(const HType *h, const khkey_t *key, khint_t hash) { \
+		khint_t i, s, n_old = (khint_t)1U << h->old_bits, mask = n_old - 1U; \
+		i = __kh_h2b(hash, h->old_bits); \
+		if (i < h->mig) i = h->mig; \
+		for (s = n_old - h->mig; s > 0; --s) { /* at most n_old-mig unmigrated buckets; they may all be occupied */ \
+			if (!__kh_used(h->old_used, i)) break; \
+			if (__hash_eq(h->old_keys[i], *key)) return i; \
+			i = (i + 1U) & mask; \
+			if (i == 0) i = h->mig; \
+		} \
+		return n_old; \
+	} \
+	static void prefix##_old_del(HType *h, khint_t i) { /* backward shift in the old array, skipping migrated buckets */ \
+		khint_t j = i, k, mask = ((khint_t)1U << h->old_bits) - 1U; \
+		while (1) { \
+			j = (j + 1U) & mask; \
+			if (j == 0) j = h->mig; \
+			if (j == i || !__kh_used(h->old_used, j)) break; \
+			k = __kh_h2b(__hash_fn(h->old_keys[j]), h->old_bits); \
+			if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) \
+				h->old_keys[i] = h->old_keys[j], i = j; \
+		} \
+		__kh_set_unused(h->old_used, i); \
+	} \
+	static khint_t prefix##_old_move(HType *h, const khkey_t *key, khint_t hash, khint_t i) { /* move key to empty bucket i in the new array if present in the old */ \
+		khint_t j; \
+		if (h->old_keys == 0) return 0; \
+		j = prefix##_old_getp(h, key, hash); \
+		if (j == (khint_t)1U << h->old_bits) return 0; \
+		h->keys[i] = h->old_keys[j]; \
+		__kh_set_used(h->used, i); \
+		prefix##_old_del(h, j); \
+		return 1; \
+	}
+
+#define __KHASHL_INCR_IMPL_RESIZE(SCOPE, HType, prefix, khkey_t) \
+	SCOPE int prefix##_resize(HType *h, khint_t new_n_buckets) { /* start migration; the bulk of work is deferred */ \
+		khint32_t *new_used; \
+		khkey_t *new_keys; \
+		khint_t j = 0, x = new_n_buckets, new_bits; \
+		while ((x >>= 1) != 0) ++j; \
+		if (new_n_buckets & (new_n_buckets - 1)) ++j; \
+		new_bits = j > 2? j : 2; \
+		new_n_buckets = (khint_t)1U << new_bits; \
+		if (h->count > kh_max_count(new_n_buckets)) return 0; /* requested size is too small */ \
+		prefix##_finish(h); /* only one migration at a time */ \
+		new_used = Kcalloc(h->km, khint32_t, __kh_fsize(new_n_buckets)); \
+		if (!new_used) return -1; /* not enough memory */ \
+		new_keys = Kmalloc(h->km, khkey_t, new_n_buckets); \
+		if (!new_keys) { Kfree(h->km, new_used); return -1; } \
+		if (h->count > 0) { \
+			h->old_keys = h->keys, h->old_used = h->used; \
+			h->old_bits = h->bits, h->mig = 0; \
+		} else { \
+			Kfree(h->km, (void*)h->keys); Kfree(h->km, h->used); \
+		} \
+		h->keys = new_keys, h->used = new_used, h->bits = new_bits; \
+		return 0; \
+	}
+
+#define __KHASHL_INCR_IMPL_GET(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	SCOPE khint_t prefix##_getp_core(HType *h, const khkey_t *key, khint_t hash) { \
+		khint_t i, last, n_buckets, mask; \
+		if (h->keys == 0) return 0; \
+		prefix##_migrate(h, kh_mig_step); \
+		n_buckets = (khint_t)1U << h->bits; \
+		mask = n_buckets - 1U; \
+		i = last = __kh_h2b(hash, h->bits); \
+		while (__kh_used(h->used, i) && !__hash_eq(h->keys[i], *key)) { \
+			i = (i + 1U) & mask; \
+			if (i == last) return n_buckets; \
+		} \
+		if (__kh_used(h->used, i)) return i; \
+		return prefix##_old_move(h, key, hash, i)? i : n_buckets; \
+	} \
+	SCOPE khint_t prefix##_getp(HType *h, const khkey_t *key) { return prefix##_getp_core(h, key, __hash_fn(*key)); } \
+	SCOPE khint_t prefix##_get(HType *h, khkey_t key) { return prefix##_getp_core(h, &key, __hash_fn(key)); }
+
+#define __KHASHL_INCR_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	SCOPE khint_t prefix##_putp_core(HType *h, const khkey_t *key, khint_t hash, int *absent) { \
+		khint_t n_buckets, i, last, mask; \
+		prefix##_migrate(h, kh_mig_step); \
+		n_buckets = h->keys? (khint_t)1U<<h->bits : 0U; \
+		*absent = -1; \
+		if (h->count >= kh_max_count(n_buckets)) { /* start rehashing; finishes the previous one if unfinished */ \
+			if (prefix##_resize(h, n_buckets + 1U) < 0) \
+				return n_buckets; \
+			n_buckets = (khint_t)1U<<h->bits; \
+		} \
+		mask = n_buckets - 1; \
+		i = last = __kh_h2b(hash, h->bits); \
+		while (__kh_used(h->used, i) && !__hash_eq(h->keys[i], *key)) { \
+			i = (i + 1U) & mask; \
+			if (i == last) break; \
+		} \
+		if (__kh_used(h->used, i) || prefix##_old_move(h, key, hash, i)) { \
+			*absent = 0; /* Don't touch h->keys[i] if present */ \
+		} else { /* not present at all */ \
+			h->keys[i] = *key; \
+			__kh_set_used(h->used, i); \
+			++h->count; \
+			*absent = 1; \
+		} \
+		return i; \
+	} \
+	SCOPE khint_t prefix##_putp(HType *h, const khkey_t *key, int *absent) { return prefix##_putp_core(h, key, __hash_fn(*key), absent); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { return prefix##_putp_core(h, &key, __hash_fn(key), absent); }
+
+#define KHASHL_INCR_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_INCR_TYPE(HType, khkey_t) \
+	__KHASHL_INCR_IMPL_BASIC(SCOPE, HType, prefix) \
+	__KHASHL_INCR_IMPL_MIGRATE(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_INCR_IMPL_RESIZE(SCOPE, HType, prefix, khkey_t) \
+	__KHASHL_INCR_IMPL_GET(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_INCR_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_IMPL_DEL(SCOPE, HType, prefix##_new, khkey_t, __hash_fn) \
+	SCOPE int prefix##_del(HType *h, khint_t k) { \
+		int ret = prefix##_new_del(h, k); \
+		prefix##_migrate(h, kh_mig_step); /* after deletion such that k is still valid */ \
+		return ret; \
+	}
+
+/*************************************************
+ * Hash table with SIMD probing of control bytes *
+ *************************************************/
+
+/* Each bucket has a control byte: 0x80 if empty or the low 7 bits of the
+ * hash otherwise. Probing is still linear from the home bucket, but a group
+ * of __KH_GROUP control bytes is matched at once and the full key is only
+ * compared on a 7-bit match. The first __KH_GROUP control bytes are mirrored
+ * after the end such that a group never wraps around. Deletion and resizing
+ * follow the bit-array version, at one byte instead of one bit per bucket. */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define __KH_GROUP_BITS  5
+#define __KH_GROUP_SHIFT 0 /* bit p<<__KH_GROUP_SHIFT of a mask corresponds to byte p in the group */
+typedef __m256i __kh_group_t;
+#define __kh_group_load(p)     _mm256_loadu_si256((const __m256i*)(p))
+#define __kh_group_match(g, c) ((khint64_t)(khint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((g), _mm256_set1_epi8((char)(c)))))
+#define __kh_group_empty(g)    ((khint64_t)(khint32_t)_mm256_movemask_epi8(g))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define __KH_GROUP_BITS  4
+#define __KH_GROUP_SHIFT 0
+typedef __m128i __kh_group_t;
+#define __kh_group_load(p)     _mm_loadu_si128((const __m128i*)(p))
+#define __kh_group_match(g, c) ((khint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8((g), _mm_set1_epi32(0x01010101 * (c))))) /* faster than _mm_set1_epi8() with gcc */
+#define __kh_group_empty(g)    ((khint64_t)_mm_movemask_epi8(g))
+#else /* SWAR on 64-bit words; matches may be false positives, which are filtered by key comparison */
+#define __KH_GROUP_BITS  3
+#define __KH_GROUP_SHIFT 3
+typedef khint64_t __kh_group_t;
+static kh_inline khint64_t __kh_group_load(const unsigned char *p) { khint64_t x; memcpy(&x, p, 8); return x; } /* little-endian assumed */
+static kh_inline khint64_t __kh_group_match(khint64_t g, unsigned char c) {
+	khint64_t x = g ^ (0x0101010101010101ULL * c);
+	return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+}
+#define __kh_group_empty(g)    ((g) & 0x8080808080808080ULL)
+#endif
+#define __KH_GROUP (1U<<__KH_GROUP_BITS)
+
+static kh_inline khint_t __kh_ctz64(khint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	khint_t r = 0;
+	for (; (x & 1) == 0; x >>= 1) ++r;
+	return r;
+#endif
+}
+
+#define __kh_simd_h7(hash) ((unsigned char)((hash) & 0x7f))
+#define __kh_simd_set_ctrl(h, i, c) do { \
+		(h)->ctrl[(i)] = (c); \
+		if ((i) < __KH_GROUP) (h)->ctrl[(i) + (1U<<(h)->bits)] = (c); \
+	} while (0)
+
+#define __KHASHL_SIMD_TYPE(HType, khkey_t) \
+	typedef struct HType { \
+		void *km; \
+		khint_t bits, count; \
+		unsigned char *ctrl; \
+		khkey_t *keys; \
+	} HType;
+
+#define __KHASHL_SIMD_IMPL_BASIC(SCOPE, HType, prefix) \
+	SCOPE HType *prefix##_init2(void *km) { \
+		HType *h = Kcalloc(km, HType, 1); \
+		h->km = km; \
+		return h; \
+	} \
+	SCOPE HType *prefix##_init(void) { return prefix##_init2(0); } \
+	SCOPE void prefix##_destroy(HType *h) { \
+		if (!h) return; \
+		Kfree(h->km, (void*)h->keys); Kfree(h->km, h->ctrl); \
+		Kfree(h->km, h); \
+	} \
+	SCOPE void prefix##_clear(HType *h) { \
+		if (h && h->ctrl) { \
+			khint_t n_buckets = (khint_t)1U << h->bits; \
+			memset(h->ctrl, 0x80, n_buckets + __KH_GROUP); \
+			h->count = 0; \
+		} \
+	}
+
+#define __KHASHL_SIMD_IMPL_GET(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	SCOPE khint_t prefix##_getp_core(const HType *h, const khkey_t *key, khint_t hash) { \
+		khint_t i, mask; \
+		unsigned char h7 = __kh_simd_h7(hash); \
+		if (h->keys == 0) return 0; \
+		mask = ((khint_t)1U << h->bits) - 1U; \
+		i = __kh_h2b(hash, h->bits); \
+		while (1) { /* terminates as the table is never full */ \
+			__kh_group_t g = __kh_group_load(h->ctrl + i); \
+			khint64_t m = __kh_group_match(g, h7), e = __kh_group_empty(g); \
+			if (e) m &= (e & (~e + 1)) - 1; /* only consider buckets before the first empty bucket */ \
+			for (; m; m &= m - 1) { \
+				khint_t k = (i + (__kh_ctz64(m) >> __KH_GROUP_SHIFT)) & mask; \
+				if (__hash_eq(h->keys[k], *key)) return k; \
+			} \
+			if (e) return mask + 1U; \
+			i = (i + __KH_GROUP) & mask; \
+		} \
+	} \
+	SCOPE khint_t prefix##_getp(const HType *h, const khkey_t *key) { return prefix##_getp_core(h, key, __hash_fn(*key)); } \
+	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { return prefix##_getp_core(h, &key, __hash_fn(key)); }
+
+#define __KHASHL_SIMD_IMPL_RESIZE(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	SCOPE int prefix##_resize(HType *h, khint_t new_n_buckets) { \
+		unsigned char *new_ctrl = 0; \
+		khint_t j = 0, x = new_n_buckets, n_buckets, new_bits, new_mask; \
+		while ((x >>= 1) != 0) ++j; \
+		if (new_n_buckets & (new_n_buckets - 1)) ++j; \
+		new_bits = j > __KH_GROUP_BITS? j : __KH_GROUP_BITS; /* a group must not cover a bucket twice */ \
+		new_n_buckets = (khint_t)1U << new_bits; \
+		if (h->count > kh_max_count(new_n_buckets)) return 0; /* requested size is too small */ \
+		new_ctrl = Kmalloc(h->km, unsigned char, new_n_buckets + __KH_GROUP); \
+		if (!new_ctrl) return -1; /* not enough memory */ \
+		memset(new_ctrl, 0x80, new_n_buckets + __KH_GROUP); \
+		n_buckets = h->keys? (khint_t)1U<<h->bits : 0U; \
+		if (n_buckets < new_n_buckets) { /* expand */ \
+			khkey_t *new_keys = Krealloc(h->km, khkey_t, h->keys, new_n_buckets); \
+			if (!new_keys) { Kfree(h->km, new_ctrl); return -1; } \
+			h->keys = new_keys; \
+		} /* otherwise shrink */ \
+		new_mask = new_n_buckets - 1; \
+		for (j = 0; j != n_buckets; ++j) { \
+			khkey_t key; \
+			if (h->ctrl[j] & 0x80) continue; \
+			key = h->keys[j]; \
+			h->ctrl[j] = 0x80; \
+			while (1) { /* kick-out process as in __KHASHL_IMPL_RESIZE */ \
+				khint_t i, hash = __hash_fn(key); \
+				i = __kh_h2b(hash, new_bits); \
+				while (!(new_ctrl[i] & 0x80)) i = (i + 1) & new_mask; \
+				new_ctrl[i] = __kh_simd_h7(hash); \
+				if (i < n_buckets && !(h->ctrl[i] & 0x80)) { /* kick out the existing element */ \
+					{ khkey_t tmp = h->keys[i]; h->keys[i] = key; key = tmp; } \
+					h->ctrl[i] = 0x80; /* mark it as deleted in the old hash table */ \
+				} else { /* write the element and jump out of the loop */ \
+					h->keys[i] = key; \
+					break; \
+				} \
+			} \
+		} \
+		memcpy(new_ctrl + new_n_buckets, new_ctrl, __KH_GROUP); /* the mirrored tail */ \
+		if (n_buckets > new_n_buckets) /* shrink the hash table */ \
+			h->keys = Krealloc(h->km, khkey_t, (void*)h->keys, new_n_buckets); \
+		Kfree(h->km, h->ctrl); /* free the working space */ \
+		h->ctrl = new_ctrl, h->bits = new_bits; \
+		return 0; \
+	}
+
+#define __KHASHL_SIMD_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	SCOPE khint_t prefix##_putp_core(HType *h, const khkey_t *key, khint_t hash, int *absent) { \
+		khint_t n_buckets, i, mask; \
+		unsigned char h7 = __kh_simd_h7(hash); \
+		n_buckets = h->keys? (khint_t)1U<<h->bits : 0U; \
+		*absent = -1; \
+		if (h->count >= kh_max_count(n_buckets)) { /* rehashing */ \
+			if (prefix##_resize(h, n_buckets + 1U) < 0) \
+				return n_buckets; \
+			n_buckets = (khint_t)1U<<h->bits; \
+		} \
+		mask = n_buckets - 1; \
+		i = __kh_h2b(hash, h->bits); \
+		while (1) { \
+			__kh_group_t g = __kh_group_load(h->ctrl + i); \
+			khint64_t m = __kh_group_match(g, h7), e = __kh_group_empty(g); \
+			if (e) m &= (e & (~e + 1)) - 1; \
+			for (; m; m &= m - 1) { \
+				khint_t k = (i + (__kh_ctz64(m) >> __KH_GROUP_SHIFT)) & mask; \
+				if (__hash_eq(h->keys[k], *key)) { \
+					*absent = 0; /* Don't touch h->keys[k] if present */ \
+					return k; \
+				} \
+			} \
+			if (e) { /* not present at all; insert to the first empty bucket */ \
+				i = (i + (__kh_ctz64(e) >> __KH_GROUP_SHIFT)) & mask; \
+				h->keys[i] = *key; \
+				__kh_simd_set_ctrl(h, i, h7); \
+				++h->count; \
+				*absent = 1; \
+				return i; \
+			} \
+			i = (i + __KH_GROUP) & mask; \
+		} \
+	} \
+	SCOPE khint_t prefix##_putp(HType *h, const khkey_t *key, int *absent) { return prefix##_putp_core(h, key, __hash_fn(*key), absent); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { return prefix##_putp_core(h, &key, __hash_fn(key), absent); }
+
+#define __KHASHL_SIMD_IMPL_DEL(SCOPE, HType, prefix, khkey_t, __hash_fn) \
+	SCOPE int prefix##_del(HType *h, khint_t i) { \
+		khint_t j = i, k, mask, n_buckets; \
+		if (h->keys == 0) return 0; \
+		n_buckets = (khint_t)1U<<h->bits; \
+		mask = n_buckets - 1U; \
+		while (1) { \
+			j = (j + 1U) & mask; \
+			if (j == i || (h->ctrl[j] & 0x80)) break; \
+			k = __kh_h2b(__hash_fn(h->keys[j]), h->bits); \
+			if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) { \
+				h->keys[i] = h->keys[j]; \
+				__kh_simd_set_ctrl(h, i, h->ctrl[j]); \
+				i = j; \
+			} \
+		} \
+		__kh_simd_set_ctrl(h, i, 0x80); \
+		--h->count; \
+		return 1; \
+	}
+
+#define KHASHL_SIMD_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_SIMD_TYPE(HType, khkey_t) \
+	__KHASHL_SIMD_IMPL_BASIC(SCOPE, HType, prefix) \
+	__KHASHL_SIMD_IMPL_GET(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_SIMD_IMPL_RESIZE(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_SIMD_IMPL_PUT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	__KHASHL_SIMD_IMPL_DEL(SCOPE, HType, prefix, khkey_t, __hash_fn)
 
 /***************************
  * Ensemble of hash tables *
@@ -326,6 +841,130 @@ typedef struct {
 		int i; \
 		for (i = 0; i < 1U<<g->bits; ++i) prefix##_sub_clear(&g->sub[i]); \
 		g->count = 0; \
+	} \
+	SCOPE int prefix##_shrink_to_fit(HType *g) { \
+		int i, ret = 0; \
+		for (i = 0; i < 1U<<g->bits; ++i) \
+			if (prefix##_sub_shrink_to_fit(&g->sub[i]) < 0) ret = -1; \
+		return ret; \
+	}
+
+/*********************************************
+ * Thread-safe ensemble with per-table locks *
+ *********************************************/
+
+/* Each sub-table is guarded by a spinlock on its own cache line. All
+ * functions take the lock internally and never return positions, which may
+ * be invalidated by other threads; get() copies the bucket out and
+ * update_fn() applies a callback to the bucket while holding the lock. If
+ * the callback returns nonzero, the bucket is deleted. Requires GCC-style
+ * __atomic builtins. */
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#define __kh_yield() sched_yield()
+#else
+#define __kh_yield()
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define __kh_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define __kh_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define __kh_cpu_relax()
+#endif
+
+static kh_inline void __kh_spin_lock(int *lock) {
+	int n = 0;
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+			if (++n < 1024) __kh_cpu_relax();
+			else __kh_yield(), n = 0; /* the holder may have been preempted */
+		}
+	}
+}
+
+static kh_inline void __kh_spin_unlock(int *lock) { __atomic_store_n(lock, 0, __ATOMIC_RELEASE); }
+
+#define KHASHE_MT_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	KHASHL_INIT(KH_LOCAL, HType##_sub, prefix##_sub, khkey_t, __hash_fn, __hash_eq) \
+	typedef union { \
+		struct { HType##_sub h; int lock; } s; \
+		char pad[(sizeof(HType##_sub) + sizeof(int) + 63) / 64 * 64]; /* avoid false sharing between locks */ \
+	} HType##_lsub; \
+	typedef struct HType { \
+		void *km, *mem; \
+		khint64_t count; /* updated atomically */ \
+		int bits; \
+		HType##_lsub *sub; /* aligned to 64 bytes */ \
+	} HType; \
+	SCOPE HType *prefix##_init2(void *km, int bits) { \
+		HType *g; \
+		g = Kcalloc(km, HType, 1); \
+		g->bits = bits, g->km = km; \
+		g->mem = Kcalloc(km, char, ((size_t)sizeof(HType##_lsub) << bits) + 63); \
+		g->sub = (HType##_lsub*)(((size_t)g->mem + 63) & ~(size_t)63); \
+		return g; \
+	} \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_init2(0, bits); } \
+	SCOPE void prefix##_destroy(HType *g) { \
+		int t; \
+		if (!g) return; \
+		for (t = 0; t < 1<<g->bits; ++t) { Kfree(g->km, (void*)g->sub[t].s.h.keys); Kfree(g->km, g->sub[t].s.h.used); } \
+		Kfree(g->km, g->mem); Kfree(g->km, g); \
+	} \
+	SCOPE int prefix##_putp(HType *g, const khkey_t *key) { /* return 1 if inserted or 0 if present; -1 on error */ \
+		khint_t hash = __hash_fn(*key); \
+		HType##_lsub *s = &g->sub[hash & ((1U<<g->bits) - 1)]; \
+		int absent; \
+		__kh_spin_lock(&s->s.lock); \
+		prefix##_sub_putp_core(&s->s.h, key, hash, &absent); \
+		__kh_spin_unlock(&s->s.lock); \
+		if (absent > 0) __atomic_add_fetch(&g->count, 1, __ATOMIC_RELAXED); \
+		return absent; \
+	} \
+	SCOPE int prefix##_getp(HType *g, const khkey_t *key, khkey_t *out) { /* return 1 and copy the bucket to out if present */ \
+		khint_t hash = __hash_fn(*key), k; \
+		HType##_lsub *s = &g->sub[hash & ((1U<<g->bits) - 1)]; \
+		int found; \
+		__kh_spin_lock(&s->s.lock); \
+		k = prefix##_sub_getp_core(&s->s.h, key, hash); \
+		found = (k != kh_end(&s->s.h)); \
+		if (found && out) *out = s->s.h.keys[k]; \
+		__kh_spin_unlock(&s->s.lock); \
+		return found; \
+	} \
+	SCOPE int prefix##_delp(HType *g, const khkey_t *key) { /* return 1 if deleted */ \
+		khint_t hash = __hash_fn(*key), k; \
+		HType##_lsub *s = &g->sub[hash & ((1U<<g->bits) - 1)]; \
+		int ret = 0; \
+		__kh_spin_lock(&s->s.lock); \
+		k = prefix##_sub_getp_core(&s->s.h, key, hash); \
+		if (k != kh_end(&s->s.h)) ret = prefix##_sub_del(&s->s.h, k); \
+		__kh_spin_unlock(&s->s.lock); \
+		if (ret) __atomic_sub_fetch(&g->count, 1, __ATOMIC_RELAXED); \
+		return ret; \
+	} \
+	SCOPE int prefix##_update_fnp(HType *g, const khkey_t *key, int (*fn)(khkey_t *b, int absent, void *data), void *data) { /* return absent as put() */ \
+		khint_t hash = __hash_fn(*key), k; \
+		HType##_lsub *s = &g->sub[hash & ((1U<<g->bits) - 1)]; \
+		int absent, diff = 0; \
+		__kh_spin_lock(&s->s.lock); \
+		k = prefix##_sub_putp_core(&s->s.h, key, hash, &absent); \
+		if (absent >= 0) { \
+			diff = absent; \
+			if (fn(&s->s.h.keys[k], absent, data)) \
+				diff -= prefix##_sub_del(&s->s.h, k); \
+		} \
+		__kh_spin_unlock(&s->s.lock); \
+		if (diff) __atomic_add_fetch(&g->count, diff, __ATOMIC_RELAXED); \
+		return absent; \
+	} \
+	SCOPE void prefix##_clear(HType *g) { /* not thread-safe */ \
+		int i; \
+		for (i = 0; i < 1<<g->bits; ++i) prefix##_sub_clear(&g->sub[i].s.h); \
+		g->count = 0; \
 	}
 
 /*****************************
@@ -346,6 +985,32 @@ typedef struct {
 	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_s_bucket_t t; t.key = key; return prefix##_s_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_s_del(h, k); } \
 	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_s_bucket_t t; t.key = key; return prefix##_s_putp(h, &t, absent); } \
+	SCOPE void prefix##_get_batch(const HType *h, khint_t n, const khkey_t *keys, khint_t *idx) { \
+		HType##_s_bucket_t t[256]; \
+		khint_t i, k, m; \
+		for (i = 0; i < n; i += m) { \
+			m = n - i < 256? n - i : 256; \
+			for (k = 0; k < m; ++k) t[k].key = keys[i + k]; \
+			prefix##_s_get_batch(h, m, t, &idx[i]); \
+		} \
+	} \
+	SCOPE int prefix##_put_batch(HType *h, khint_t n, const khkey_t *keys, khint_t *idx, int *absent) { \
+		HType##_s_bucket_t t[256]; \
+		khint_t i, k, m; \
+		if (h->count + n >= kh_max_count(kh_capacity(h))) { /* reserve for the whole batch such that earlier windows are not moved */ \
+			khint_t n_absent = 0; \
+			prefix##_get_batch(h, n, keys, idx); \
+			for (i = 0; i < n; ++i) n_absent += (idx[i] == kh_end(h)); \
+			if (prefix##_s_batch_grow(h, n_absent) < 0) return -1; \
+		} \
+		for (i = 0; i < n; i += m) { /* copy keys to buckets in windows */ \
+			m = n - i < 256? n - i : 256; \
+			for (k = 0; k < m; ++k) t[k].key = keys[i + k]; \
+			if (prefix##_s_put_batch(h, m, t, &idx[i], &absent[i]) < 0) return -1; \
+		} \
+		return 0; \
+	} \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_s_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_s_clear(h); }
 
 #define KHASHL_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
@@ -360,6 +1025,32 @@ typedef struct {
 	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_m_bucket_t t; t.key = key; return prefix##_m_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_m_del(h, k); } \
 	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_m_bucket_t t; t.key = key; return prefix##_m_putp(h, &t, absent); } \
+	SCOPE void prefix##_get_batch(const HType *h, khint_t n, const khkey_t *keys, khint_t *idx) { \
+		HType##_m_bucket_t t[256]; \
+		khint_t i, k, m; \
+		for (i = 0; i < n; i += m) { \
+			m = n - i < 256? n - i : 256; \
+			for (k = 0; k < m; ++k) t[k].key = keys[i + k]; \
+			prefix##_m_get_batch(h, m, t, &idx[i]); \
+		} \
+	} \
+	SCOPE int prefix##_put_batch(HType *h, khint_t n, const khkey_t *keys, khint_t *idx, int *absent) { \
+		HType##_m_bucket_t t[256]; \
+		khint_t i, k, m; \
+		if (h->count + n >= kh_max_count(kh_capacity(h))) { /* reserve for the whole batch such that earlier windows are not moved */ \
+			khint_t n_absent = 0; \
+			prefix##_get_batch(h, n, keys, idx); \
+			for (i = 0; i < n; ++i) n_absent += (idx[i] == kh_end(h)); \
+			if (prefix##_m_batch_grow(h, n_absent) < 0) return -1; \
+		} \
+		for (i = 0; i < n; i += m) { /* copy keys to buckets in windows */ \
+			m = n - i < 256? n - i : 256; \
+			for (k = 0; k < m; ++k) t[k].key = keys[i + k]; \
+			if (prefix##_m_put_batch(h, m, t, &idx[i], &absent[i]) < 0) return -1; \
+		} \
+		return 0; \
+	} \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_m_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_m_clear(h); }
 
 /* cached hashes to trade memory for performance when hashing and comparison are expensive */
@@ -375,6 +1066,7 @@ typedef struct {
 	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_cs_bucket_t t; t.key = key; t.hash = __hash_fn(key); return prefix##_cs_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_cs_del(h, k); } \
 	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_cs_bucket_t t; t.key = key, t.hash = __hash_fn(key); return prefix##_cs_putp(h, &t, absent); } \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_cs_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_cs_clear(h); }
 
 #define KHASHL_CMAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
@@ -386,8 +1078,71 @@ typedef struct {
 	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_cm_bucket_t t; t.key = key; t.hash = __hash_fn(key); return prefix##_cm_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_cm_del(h, k); } \
 	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_cm_bucket_t t; t.key = key, t.hash = __hash_fn(key); return prefix##_cm_putp(h, &t, absent); } \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_cm_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_cm_clear(h); }
 
+/* incremental rehashing to bound the worst-case latency of put() */
+
+#define KHASHL_INCR_SET_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; } kh_packed HType##_is_bucket_t; \
+	static kh_inline khint_t prefix##_is_hash(HType##_is_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_is_eq(HType##_is_bucket_t x, HType##_is_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHL_INCR_INIT(KH_LOCAL, HType, prefix##_is, HType##_is_bucket_t, prefix##_is_hash, prefix##_is_eq) \
+	SCOPE HType *prefix##_init(void) { return prefix##_is_init(); } \
+	SCOPE HType *prefix##_init2(void *km) { return prefix##_is_init2(km); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_is_destroy(h); } \
+	SCOPE void prefix##_resize(HType *h, khint_t new_n_buckets) { prefix##_is_resize(h, new_n_buckets); } \
+	SCOPE void prefix##_finish(HType *h) { prefix##_is_finish(h); } \
+	SCOPE khint_t prefix##_get(HType *h, khkey_t key) { HType##_is_bucket_t t; t.key = key; return prefix##_is_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_is_del(h, k); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_is_bucket_t t; t.key = key; return prefix##_is_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_is_clear(h); }
+
+#define KHASHL_INCR_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; kh_val_t val; } kh_packed HType##_im_bucket_t; \
+	static kh_inline khint_t prefix##_im_hash(HType##_im_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_im_eq(HType##_im_bucket_t x, HType##_im_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHL_INCR_INIT(KH_LOCAL, HType, prefix##_im, HType##_im_bucket_t, prefix##_im_hash, prefix##_im_eq) \
+	SCOPE HType *prefix##_init(void) { return prefix##_im_init(); } \
+	SCOPE HType *prefix##_init2(void *km) { return prefix##_im_init2(km); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_im_destroy(h); } \
+	SCOPE void prefix##_resize(HType *h, khint_t new_n_buckets) { prefix##_im_resize(h, new_n_buckets); } \
+	SCOPE void prefix##_finish(HType *h) { prefix##_im_finish(h); } \
+	SCOPE khint_t prefix##_get(HType *h, khkey_t key) { HType##_im_bucket_t t; t.key = key; return prefix##_im_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_im_del(h, k); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_im_bucket_t t; t.key = key; return prefix##_im_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_im_clear(h); }
+
+/* SIMD probing on a byte-per-bucket control array */
+
+#define KHASHL_SIMD_SET_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; } kh_packed HType##_ss_bucket_t; \
+	static kh_inline khint_t prefix##_ss_hash(HType##_ss_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_ss_eq(HType##_ss_bucket_t x, HType##_ss_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHL_SIMD_INIT(KH_LOCAL, HType, prefix##_ss, HType##_ss_bucket_t, prefix##_ss_hash, prefix##_ss_eq) \
+	SCOPE HType *prefix##_init(void) { return prefix##_ss_init(); } \
+	SCOPE HType *prefix##_init2(void *km) { return prefix##_ss_init2(km); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_ss_destroy(h); } \
+	SCOPE void prefix##_resize(HType *h, khint_t new_n_buckets) { prefix##_ss_resize(h, new_n_buckets); } \
+	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_ss_bucket_t t; t.key = key; return prefix##_ss_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_ss_del(h, k); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_ss_bucket_t t; t.key = key; return prefix##_ss_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_ss_clear(h); }
+
+#define KHASHL_SIMD_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; kh_val_t val; } kh_packed HType##_sm_bucket_t; \
+	static kh_inline khint_t prefix##_sm_hash(HType##_sm_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_sm_eq(HType##_sm_bucket_t x, HType##_sm_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHL_SIMD_INIT(KH_LOCAL, HType, prefix##_sm, HType##_sm_bucket_t, prefix##_sm_hash, prefix##_sm_eq) \
+	SCOPE HType *prefix##_init(void) { return prefix##_sm_init(); } \
+	SCOPE HType *prefix##_init2(void *km) { return prefix##_sm_init2(km); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_sm_destroy(h); } \
+	SCOPE void prefix##_resize(HType *h, khint_t new_n_buckets) { prefix##_sm_resize(h, new_n_buckets); } \
+	SCOPE khint_t prefix##_get(const HType *h, khkey_t key) { HType##_sm_bucket_t t; t.key = key; return prefix##_sm_getp(h, &t); } \
+	SCOPE int prefix##_del(HType *h, khint_t k) { return prefix##_sm_del(h, k); } \
+	SCOPE khint_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_sm_bucket_t t; t.key = key; return prefix##_sm_putp(h, &t, absent); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_sm_clear(h); }
+
 /* ensemble for huge hash tables */
 
 #define KHASHE_SET_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
@@ -400,6 +1155,7 @@ typedef struct {
 	SCOPE kh_ensitr_t prefix##_get(const HType *h, khkey_t key) { HType##_es_bucket_t t; t.key = key; return prefix##_es_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, kh_ensitr_t k) { return prefix##_es_del(h, k); } \
 	SCOPE kh_ensitr_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_es_bucket_t t; t.key = key; return prefix##_es_putp(h, &t, absent); } \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_es_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_es_clear(h); }
 
 #define KHASHE_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
@@ -412,8 +1168,56 @@ typedef struct {
 	SCOPE kh_ensitr_t prefix##_get(const HType *h, khkey_t key) { HType##_em_bucket_t t; t.key = key; return prefix##_em_getp(h, &t); } \
 	SCOPE int prefix##_del(HType *h, kh_ensitr_t k) { return prefix##_em_del(h, k); } \
 	SCOPE kh_ensitr_t prefix##_put(HType *h, khkey_t key, int *absent) { HType##_em_bucket_t t; t.key = key; return prefix##_em_putp(h, &t, absent); } \
+	SCOPE int prefix##_shrink_to_fit(HType *h) { return prefix##_em_shrink_to_fit(h); } \
 	SCOPE void prefix##_clear(HType *h) { prefix##_em_clear(h); }
 
+/* thread-safe ensemble */
+
+#define KHASHE_MT_SET_INIT(SCOPE, HType, prefix, khkey_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; } kh_packed HType##_ts_bucket_t; \
+	static kh_inline khint_t prefix##_ts_hash(HType##_ts_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_ts_eq(HType##_ts_bucket_t x, HType##_ts_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	KHASHE_MT_INIT(KH_LOCAL, HType, prefix##_ts, HType##_ts_bucket_t, prefix##_ts_hash, prefix##_ts_eq) \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_ts_init(bits); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_ts_destroy(h); } \
+	SCOPE int prefix##_get(HType *h, khkey_t key) { HType##_ts_bucket_t t; t.key = key; return prefix##_ts_getp(h, &t, 0); } \
+	SCOPE int prefix##_del(HType *h, khkey_t key) { HType##_ts_bucket_t t; t.key = key; return prefix##_ts_delp(h, &t); } \
+	SCOPE int prefix##_put(HType *h, khkey_t key) { HType##_ts_bucket_t t; t.key = key; return prefix##_ts_putp(h, &t); } \
+	SCOPE void prefix##_clear(HType *h) { prefix##_ts_clear(h); }
+
+#define KHASHE_MT_MAP_INIT(SCOPE, HType, prefix, khkey_t, kh_val_t, __hash_fn, __hash_eq) \
+	typedef struct { khkey_t key; kh_val_t val; } kh_packed HType##_tm_bucket_t; \
+	typedef struct { int (*fn)(kh_val_t *val, int absent, void *data); void *data; } HType##_tm_fn_t; \
+	static kh_inline khint_t prefix##_tm_hash(HType##_tm_bucket_t x) { return __hash_fn(x.key); } \
+	static kh_inline int prefix##_tm_eq(HType##_tm_bucket_t x, HType##_tm_bucket_t y) { return __hash_eq(x.key, y.key); } \
+	static int prefix##_tm_call(HType##_tm_bucket_t *b, int absent, void *data) { \
+		HType##_tm_fn_t *f = (HType##_tm_fn_t*)data; \
+		kh_val_t v = b->val; /* buckets are packed; don't take the address of a member */ \
+		int ret = f->fn(&v, absent, f->data); \
+		b->val = v; \
+		return ret; \
+	} \
+	KHASHE_MT_INIT(KH_LOCAL, HType, prefix##_tm, HType##_tm_bucket_t, prefix##_tm_hash, prefix##_tm_eq) \
+	SCOPE HType *prefix##_init(int bits) { return prefix##_tm_init(bits); } \
+	SCOPE void prefix##_destroy(HType *h) { prefix##_tm_destroy(h); } \
+	SCOPE int prefix##_get(HType *h, khkey_t key, kh_val_t *val) { \
+		HType##_tm_bucket_t t, b; \
+		int ret; \
+		t.key = key; \
+		ret = prefix##_tm_getp(h, &t, &b); \
+		if (ret && val) *val = b.val; \
+		return ret; \
+	} \
+	SCOPE int prefix##_del(HType *h, khkey_t key) { HType##_tm_bucket_t t; t.key = key; return prefix##_tm_delp(h, &t); } \
+	SCOPE int prefix##_put(HType *h, khkey_t key, kh_val_t val) { HType##_tm_bucket_t t; t.key = key, t.val = val; return prefix##_tm_putp(h, &t); } \
+	SCOPE int prefix##_update_fn(HType *h, khkey_t key, int (*fn)(kh_val_t *val, int absent, void *data), void *data) { \
+		HType##_tm_bucket_t t; \
+		HType##_tm_fn_t f; \
+		t.key = key, f.fn = fn, f.data = data; \
+		return prefix##_tm_update_fnp(h, &t, prefix##_tm_call, &f); \
+	} \
+	SCOPE void prefix##_clear(HType *h) { prefix##_tm_clear(h); }
+
 /**************************
  * Public macro functions *
  **************************/
@@ -427,7 +1231,10 @@ typedef struct {
 #define kh_val(h, x) ((h)->keys[x].val)
 #define kh_exist(h, x) __kh_used((h)->used, (x))
 
-#define kh_foreach(h, x) for ((x) = 0; (x) != kh_end(h); ++(x)) if (kh_exist((h), (x)))
+#define kh_foreach(h, x) for ((x) = __kh_used_next((h)->used, 0, kh_end(h)); (x) != kh_end(h); (x) = __kh_used_next((h)->used, (x) + 1, kh_end(h)))
+
+#define kh_simd_exist(h, x) (!((h)->ctrl[x] & 0x80))
+#define kh_simd_foreach(h, x) for ((x) = 0; (x) != kh_end(h); ++(x)) if (kh_simd_exist((h), (x)))
 
 #define kh_ens_key(g, x) kh_key(&(g)->sub[(x).sub], (x).pos)
 #define kh_ens_val(g, x) kh_val(&(g)->sub[(x).sub], (x).pos)
@@ -435,7 +1242,7 @@ typedef struct {
 #define kh_ens_is_end(x) ((x).pos == (khint_t)-1)
 #define kh_ens_size(g) ((g)->count)
 
-#define kh_ens_foreach(g, x) for ((x).sub = 0; (x).sub != 1<<(g)->bits; ++(x).sub) for ((x).pos = 0; (x).pos != kh_end(&(g)->sub[(x).sub]); ++(x).pos) if (kh_ens_exist((g), (x)))
+#define kh_ens_foreach(g, x) for ((x).sub = 0; (x).sub != 1<<(g)->bits; ++(x).sub) for ((x).pos = __kh_used_next((g)->sub[(x).sub].used, 0, kh_end(&(g)->sub[(x).sub])); (x).pos != kh_end(&(g)->sub[(x).sub]); (x).pos = __kh_used_next((g)->sub[(x).sub].used, (x).pos + 1, kh_end(&(g)->sub[(x).sub])))
 
 /**************************************
  * Common hash and equality functions *
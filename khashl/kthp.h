@@ -0,0 +1,194 @@
+/* The MIT License
+
+   Copyright (c) 2024- by Attractive Chaos <attractor@live.co.uk>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+/* Huge-page allocator for the Kmalloc/Kcalloc/Krealloc/Kfree hooks in
+ * khashl.h. Include this header BEFORE khashl.h. Large blocks (the keys and
+ * used arrays) are served from 2MB-aligned anonymous mappings advised with
+ * MADV_HUGEPAGE; small blocks (the table struct) go to malloc(). Pass a
+ * kthp_t* as km to prefix_init2() to tune the behavior; km==0 uses
+ * KTHP_DEFAULT_FLAG. With KTHP_HUGETLB, MAP_HUGETLB is tried first and we
+ * silently fall back to MADV_HUGEPAGE if no hugetlbfs pages are reserved.
+ */
+
+#ifndef __AC_KTHP_H
+#define __AC_KTHP_H
+
+#define AC_VERSION_KTHP_H "r1"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for mremap(); only effective if this header is included first */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define KTHP_PAGE    (1ULL<<21) /* 2MB; the x86-64 and aarch64 huge page size */
+#define KTHP_HEADER  64         /* keep the payload cache-line aligned */
+#define KTHP_HUGETLB 0x1        /* try MAP_HUGETLB before MADV_HUGEPAGE */
+
+#ifndef KTHP_DEFAULT_FLAG
+#define KTHP_DEFAULT_FLAG 0
+#endif
+
+#ifndef KTHP_MIN_SIZE /* blocks smaller than this are allocated with malloc() */
+#define KTHP_MIN_SIZE (KTHP_PAGE>>1)
+#endif
+
+typedef struct {
+	int flag;
+	size_t min_size;    /* 0 for KTHP_MIN_SIZE */
+	size_t n_mapped;    /* bytes currently mapped */
+	size_t n_hugetlb_fail; /* number of MAP_HUGETLB failures */
+} kthp_t;
+
+typedef struct { /* stored in the KTHP_HEADER bytes in front of each block */
+	size_t map_len;     /* 0 if allocated with malloc() */
+	size_t size;
+	int hugetlb;
+} kthp_hdr_t;
+
+static kthp_t kthp_default = { KTHP_DEFAULT_FLAG, 0, 0, 0 };
+
+#define kthp_hdr(p) ((kthp_hdr_t*)((uint8_t*)(p) - KTHP_HEADER))
+#define kthp_len(size) (((size) + KTHP_HEADER + KTHP_PAGE - 1) / KTHP_PAGE * KTHP_PAGE)
+
+static inline kthp_t *kthp_km(void *km) { return km? (kthp_t*)km : &kthp_default; }
+
+/* map $len bytes at a 2MB boundary; if $reserve is set, reserve address space only (for mremap) */
+static void *kthp_map(kthp_t *km, size_t len, int *hugetlb, int reserve)
+{
+	uint8_t *p, *q;
+	*hugetlb = 0;
+#ifdef MAP_HUGETLB
+	if (!reserve && (km->flag & KTHP_HUGETLB)) {
+		p = (uint8_t*)mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			*hugetlb = 1;
+			return p;
+		}
+		++km->n_hugetlb_fail;
+	}
+#endif
+	p = (uint8_t*)mmap(0, len + KTHP_PAGE, reserve? PROT_NONE : PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) return 0;
+	q = (uint8_t*)(((uintptr_t)p + KTHP_PAGE - 1) & ~(uintptr_t)(KTHP_PAGE - 1));
+	if (q > p) munmap(p, q - p); /* trim the unaligned head and tail */
+	if (p + KTHP_PAGE > q) munmap(q + len, p + KTHP_PAGE - q);
+#ifdef MADV_HUGEPAGE
+	if (!reserve) madvise(q, len, MADV_HUGEPAGE);
+#endif
+	return q;
+}
+
+static void *kthp_malloc(void *km_, size_t size)
+{
+	kthp_t *km = kthp_km(km_);
+	kthp_hdr_t *h;
+	if (size < (km->min_size? km->min_size : KTHP_MIN_SIZE)) {
+		h = (kthp_hdr_t*)malloc(size + KTHP_HEADER);
+		if (h == 0) return 0;
+		h->map_len = 0, h->hugetlb = 0;
+	} else {
+		size_t len = kthp_len(size);
+		int hugetlb;
+		h = (kthp_hdr_t*)kthp_map(km, len, &hugetlb, 0);
+		if (h == 0) return 0;
+		h->map_len = len, h->hugetlb = hugetlb;
+		km->n_mapped += len;
+	}
+	h->size = size;
+	return (uint8_t*)h + KTHP_HEADER;
+}
+
+static void kthp_free(void *km_, void *p)
+{
+	kthp_hdr_t *h;
+	if (p == 0) return;
+	h = kthp_hdr(p);
+	if (h->map_len) {
+		kthp_km(km_)->n_mapped -= h->map_len;
+		munmap(h, h->map_len);
+	} else free(h);
+}
+
+static void *kthp_calloc(void *km, size_t n, size_t size)
+{
+	void *p = kthp_malloc(km, n * size);
+	if (p && kthp_hdr(p)->map_len == 0) memset(p, 0, n * size); /* fresh mappings are zeroed */
+	return p;
+}
+
+static void *kthp_realloc(void *km_, void *p, size_t size)
+{
+	kthp_t *km = kthp_km(km_);
+	kthp_hdr_t *h;
+	void *q;
+	if (p == 0) return kthp_malloc(km_, size);
+	h = kthp_hdr(p);
+	if (h->map_len && size + KTHP_HEADER <= h->map_len) { /* fits in the current mapping; release the tail */
+		size_t len = kthp_len(size);
+		if (len < h->map_len) {
+			munmap((uint8_t*)h + len, h->map_len - len);
+			km->n_mapped -= h->map_len - len;
+			h->map_len = len;
+		}
+		h->size = size;
+		return p;
+	}
+#if defined(__linux__) && defined(MREMAP_FIXED)
+	if (h->map_len && !h->hugetlb) { /* move the page tables to an aligned reservation instead of copying */
+		size_t len = kthp_len(size), old_len = h->map_len;
+		int hugetlb;
+		uint8_t *r = (uint8_t*)kthp_map(km, len, &hugetlb, 1);
+		if (r) {
+			void *s = mremap(h, old_len, len, MREMAP_MAYMOVE|MREMAP_FIXED, r);
+			if (s != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+				madvise(s, len, MADV_HUGEPAGE);
+#endif
+				km->n_mapped += len - old_len; /* the old address is gone now */
+				h = (kthp_hdr_t*)s;
+				h->map_len = len, h->size = size;
+				return (uint8_t*)h + KTHP_HEADER;
+			}
+			munmap(r, len);
+		}
+	}
+#endif
+	q = kthp_malloc(km_, size);
+	if (q == 0) return 0;
+	memcpy(q, p, h->size < size? h->size : size);
+	kthp_free(km_, p);
+	return q;
+}
+
+#define Kmalloc(km, type, cnt)       ((type*)kthp_malloc((km), (cnt) * sizeof(type)))
+#define Kcalloc(km, type, cnt)       ((type*)kthp_calloc((km), (cnt), sizeof(type)))
+#define Krealloc(km, type, ptr, cnt) ((type*)kthp_realloc((km), (ptr), (cnt) * sizeof(type)))
+#define Kfree(km, ptr)               kthp_free((km), (ptr))
+
+#endif
@@ -0,0 +1,50 @@
+#include "../common.c"
+#include "khashl.h"
+
+KHASHL_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+
+#define BUF_N 1024
+
+void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j, k, m;
+	uint64_t z = 0, x = x0;
+	uint32_t keys[BUF_N];
+	khint_t idx[BUF_N];
+	int absent[BUF_N];
+	intmap_t *h = intmap_init();
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; i += m) {
+			m = n - i < BUF_N? n - i : BUF_N;
+			for (k = 0; k < m; ++k) {
+				uint64_t y = udb_splitmix64(&x);
+				keys[k] = udb_get_key(n, y);
+			}
+			if (is_del) { // deletion moves elements, so get_batch() only warms the cache; each op is then resolved in order
+				intmap_get_batch(h, m, keys, idx);
+				for (k = 0; k < m; ++k) {
+					khint_t p;
+					int a;
+					p = intmap_put(h, keys[k], &a);
+					if (a) kh_val(h, p) = i + k, ++z;
+					else intmap_del(h, p);
+				}
+			} else {
+				intmap_put_batch(h, m, keys, idx, absent);
+				for (k = 0; k < m; ++k) {
+					if (absent[k]) kh_val(h, idx[k]) = 0;
+					z += ++kh_val(h, idx[k]);
+				}
+			}
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			khint_t k;
+			kh_foreach(h, k) s += kh_val(h, k);
+			udb_scan_end(s);
+		}
+		udb_measure(n, kh_size(h), z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
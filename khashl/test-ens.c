@@ -1,3 +1,4 @@
+#define UDB_TEST_LAT
 #include "../common.c"
 #include "khashl.h"
 
@@ -22,7 +23,10 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 			int absent;
 			uint64_t y = udb_splitmix64(&x);
 			uint32_t key = udb_get_key(n, y);
+			khint_t cap;
 			g = h[udb_hash_fn(key) & KH_SUB_MASK];
+			cap = udb_lat.k? kh_capacity(g) : 0; // only needed when sampling latencies
+			udb_lat_begin();
 			k = intmap_put(g, key, &absent);
 			if (is_del) {
 				if (absent) kh_val(g, k) = i, ++z;
@@ -31,6 +35,14 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				if (absent) kh_val(g, k) = 0;
 				z += ++kh_val(g, k);
 			}
+			udb_lat_end(udb_lat.k && kh_capacity(g) != cap);
+		}
+		if (udb_scan_begin()) {
+			uint64_t sum = 0;
+			khint_t k;
+			for (s = 0; s < KH_SUB_N; ++s)
+				kh_foreach(h[s], k) sum += kh_val(h[s], k);
+			udb_scan_end(sum);
 		}
 		uint32_t size = 0;
 		for (s = 0; s < KH_SUB_N; ++s)
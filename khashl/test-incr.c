@@ -0,0 +1,42 @@
+#define UDB_TEST_LAT
+#include "../common.c"
+#include "khashl.h"
+
+KHASHL_INCR_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+
+void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	intmap_t *h = intmap_init();
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			khint_t k;
+			int absent;
+			uint64_t y = udb_splitmix64(&x);
+			khint_t cap = udb_lat.k? kh_capacity(h) : 0; // only needed when sampling latencies
+			udb_lat_begin();
+			k = intmap_put(h, udb_get_key(n, y), &absent);
+			if (is_del) {
+				if (absent) kh_val(h, k) = i, ++z;
+				else intmap_del(h, k);
+			} else {
+				if (absent) kh_val(h, k) = 0;
+				z += ++kh_val(h, k);
+			}
+			udb_lat_end(udb_lat.k && kh_capacity(h) != cap);
+		}
+		if (udb_scan_begin()) { // visit both arrays; prefix_finish() would move migration work into the scan
+			uint64_t s = 0;
+			khint_t k;
+			kh_foreach(h, k) s += kh_val(h, k);
+			if (h->old_keys)
+				for (k = h->mig; k < 1U << h->old_bits; ++k)
+					if (__kh_used(h->old_used, k)) s += h->old_keys[k].val;
+			udb_scan_end(s);
+		}
+		udb_measure(n, kh_size(h), z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
@@ -1,7 +1,20 @@
+#ifdef USE_THP
+#include "kthp.h"
+#endif
+#define UDB_TEST_LOOKUP
+#define UDB_TEST_MIX
+#define UDB_TEST_LAT
 #include "../common.c"
+#ifdef USE_SHRINK
+#define kh_min_count(cap) ((cap)>>3) /* halve the table below 12.5% load */
+#endif
 #include "khashl.h"
 
+#ifdef USE_SIMD
+KHASHL_SIMD_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+#else
 KHASHL_MAP_INIT(KH_LOCAL, intmap_t, intmap, uint32_t, uint32_t, udb_hash_fn, kh_eq_generic)
+#endif
 
 void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
 {
@@ -14,6 +27,8 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 			khint_t k;
 			int absent;
 			uint64_t y = udb_splitmix64(&x);
+			khint_t cap = udb_lat.k? kh_capacity(h) : 0; // only needed when sampling latencies
+			udb_lat_begin();
 			k = intmap_put(h, udb_get_key(n, y), &absent);
 			if (is_del) {
 				if (absent) kh_val(h, k) = i, ++z;
@@ -22,6 +37,71 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				if (absent) kh_val(h, k) = 0;
 				z += ++kh_val(h, k);
 			}
+			udb_lat_end(udb_lat.k && kh_capacity(h) != cap);
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			khint_t k;
+#ifdef USE_SIMD
+			kh_simd_foreach(h, k) s += kh_val(h, k);
+#else
+			kh_foreach(h, k) s += kh_val(h, k);
+#endif
+			udb_scan_end(s);
+		}
+		udb_measure(n, kh_size(h), z, &cp[j]);
+	}
+	intmap_destroy(h);
+}
+
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp)
+{
+	uint32_t i;
+	uint64_t z = 0, x = x0;
+	intmap_t *h = intmap_init();
+	for (i = 0; i < N; ++i) {
+		int absent;
+		khint_t k = intmap_put(h, udb_build_key(i), &absent);
+		kh_val(h, k) = i;
+	}
+	udb_measure(N, kh_size(h), 0, &cp[0]);
+	for (i = 0; i < n_q; ++i) {
+		khint_t k = intmap_get(h, udb_lookup_key(N, hit, udb_splitmix64(&x)));
+		if (k != kh_end(h)) z += kh_val(h, k) + 1;
+	}
+	udb_measure(n_q, kh_size(h), z, &cp[1]);
+	intmap_destroy(h);
+}
+
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	intmap_t *h = intmap_init();
+	for (i = 0; i < n0; ++i) {
+		int absent;
+		khint_t k = intmap_put(h, udb_build_key(i), &absent);
+		kh_val(h, k) = i;
+	}
+	udb_measure(0, kh_size(h), 0, &cp[0]);
+	for (j = 1, i = 0; j <= n_cp; ++j) {
+		n = (uint64_t)N * j / n_cp;
+		for (; i < n; ++i) {
+			uint32_t key;
+			int absent, c = udb_mix_next(udb_splitmix64(&x), &key);
+			khint_t k;
+			if (c == UDB_MIX_INSERT) {
+				k = intmap_put(h, key, &absent);
+				kh_val(h, k) = i, ++z;
+			} else {
+				k = intmap_get(h, key);
+				if (k != kh_end(h)) {
+					if (c == UDB_MIX_READ) z += kh_val(h, k);
+					else if (c == UDB_MIX_UPDATE) z += ++kh_val(h, k);
+					else intmap_del(h, k), ++z;
+				}
+			}
+			udb_mix_end(c);
 		}
 		udb_measure(n, kh_size(h), z, &cp[j]);
 	}
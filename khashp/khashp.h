@@ -139,8 +139,27 @@ static inline khint_t khp_size(const khashp_t *h) { return h->count; }
 /** Test whether a bucket is occupied */
 static inline int khp_exist(const khashp_t *h, khint_t x) { return h->used[x>>5] >> (x&0x1fU) & 1U; }
 
+/** Find the first occupied bucket at or after _x_; return khp_end(h) if none. Empty words of the bit flag are skipped. */
+static inline khint_t khp_next(const khashp_t *h, khint_t x)
+{
+	khint_t n = khp_end(h), j = x >> 5, m = n < 32? 1 : n >> 5;
+	uint32_t w;
+	if (x >= n) return n;
+	w = h->used[j] & (0xffffffffU << (x & 0x1fU));
+	while (w == 0) {
+		if (++j == m) return n;
+		w = h->used[j];
+	}
+#if defined(__GNUC__) || defined(__clang__)
+	x = j << 5 | __builtin_ctz(w);
+#else
+	for (x = j << 5; (w & 1) == 0; w >>= 1) ++x;
+#endif
+	return x < n? x : n;
+}
+
 /** Iterate over a hash table */
-#define khp_foreach(h, x) for ((x) = 0; (x) != khp_end(h); ++(x)) if (khp_exist((h), (x)))
+#define khp_foreach(h, x) for ((x) = khp_next((h), 0); (x) != khp_end(h); (x) = khp_next((h), (x) + 1))
 
 static inline void *khp_get_bucket(const khashp_t *h, khint_t i)
 {
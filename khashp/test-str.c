@@ -0,0 +1,31 @@
+#include "../common-str.c"
+#include "khashp.h"
+
+void test_str(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	khashp_t *h = khp_str_init(4, 0); // keys point into the string pool; no duplication
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			khint_t k;
+			int absent;
+			uint64_t y = udb_splitmix64(&x);
+			k = khp_str_put(h, udb_get_key(n, y), &absent);
+			if (is_del) {
+				if (absent) {
+					khp_set_val(h, k, &i);
+					++z;
+				} else khp_str_del(h, k);
+			} else {
+				uint32_t v = 0;
+				if (!absent) khp_get_val(h, k, &v);
+				z += ++v;
+				khp_set_val(h, k, &v);
+			}
+		}
+		udb_measure(n, khp_size(h), z, &cp[j]);
+	}
+	khp_str_destroy(h);
+}
@@ -36,6 +36,16 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				khp_set_val(h, k, &v);
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			khint_t k;
+			khp_foreach(h, k) {
+				uint32_t v;
+				khp_get_val(h, k, &v);
+				s += v;
+			}
+			udb_scan_end(s);
+		}
 		udb_measure(n, khp_size(h), z, &cp[j]);
 	}
 	khp_destroy(h);
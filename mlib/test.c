@@ -40,6 +40,13 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				} else z += ++*p;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			intmap_it_t it;
+			for (intmap_it(it, h); !intmap_end_p(it); intmap_next(it))
+				s += intmap_cref(it)->value;
+			udb_scan_end(s);
+		}
 		udb_measure(n, intmap_size(h), z, &cp[j]);
 	}
 	intmap_clear(h);
@@ -0,0 +1,40 @@
+#include "../common-str.c"
+#include <functional>
+
+// https://github.com/greg7mdp/parallel-hashmap
+// cloned on 2023-12-15
+#include "phmap.h"
+
+struct HashStr {
+	inline size_t operator()(const char *s) const {
+		return udb_hash_fn(s);
+	}
+};
+
+struct EqStr {
+	inline bool operator()(const char *a, const char *b) const {
+		return udb_str_eq(a, b);
+	}
+};
+
+void test_str(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	phmap::flat_hash_map<const char*, uint32_t, HashStr, EqStr> h;
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			const char *key = udb_get_key(n, y);
+			if (is_del) {
+				auto p = h.try_emplace(key, i);
+				if (p.second == false) h.erase(p.first);
+				else ++z;
+			} else {
+				z += ++h[key];
+			}
+		}
+		udb_measure(n, h.size(), z, &cp[j]);
+	}
+}
@@ -1,3 +1,9 @@
+#define UDB_TEST_LOOKUP
+#define UDB_TEST_MIX
+#define UDB_TEST_LAT
+#ifndef NO_PARALLEL
+#define UDB_TEST_MT
+#endif
 #include "../common.c"
 #include <functional>
 
@@ -25,6 +31,8 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 		for (; i < n; ++i) {
 			uint64_t y = udb_splitmix64(&x);
 			uint32_t key = udb_get_key(n, y);
+			size_t cap = udb_lat.k? h.bucket_count() : 0; // only needed when sampling latencies
+			udb_lat_begin();
 			if (is_del) {
 				auto p = h.try_emplace(key, i);
 				if (p.second == false) h.erase(p.first);
@@ -32,7 +40,103 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 			} else {
 				z += ++h[key];
 			}
+			udb_lat_end(udb_lat.k && h.bucket_count() != cap);
+		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			for (const auto &p : h) s += p.second;
+			udb_scan_end(s);
+		}
+		udb_measure(n, h.size(), z, &cp[j]);
+	}
+}
+
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp)
+{
+#ifdef NO_PARALLEL
+	phmap::flat_hash_map<uint32_t, uint32_t, Hash32> h;
+#else
+	phmap::parallel_flat_hash_map<uint32_t, uint32_t, Hash32> h;
+#endif
+	uint64_t z = 0, x = x0;
+	for (uint32_t i = 0; i < N; ++i)
+		h.emplace(udb_build_key(i), i);
+	udb_measure(N, h.size(), 0, &cp[0]);
+	for (uint32_t i = 0; i < n_q; ++i) {
+		auto p = h.find(udb_lookup_key(N, hit, udb_splitmix64(&x)));
+		if (p != h.end()) z += p->second + 1;
+	}
+	udb_measure(n_q, h.size(), z, &cp[1]);
+}
+
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+#ifdef NO_PARALLEL
+	phmap::flat_hash_map<uint32_t, uint32_t, Hash32> h;
+#else
+	phmap::parallel_flat_hash_map<uint32_t, uint32_t, Hash32> h;
+#endif
+	uint64_t z = 0, x = x0;
+	uint32_t i = 0;
+	for (; i < n0; ++i)
+		h.emplace(udb_build_key(i), i);
+	udb_measure(0, h.size(), 0, &cp[0]);
+	i = 0;
+	for (uint32_t j = 1; j <= n_cp; ++j) {
+		uint32_t n = (uint64_t)N * j / n_cp;
+		for (; i < n; ++i) {
+			uint32_t key;
+			int c = udb_mix_next(udb_splitmix64(&x), &key);
+			if (c == UDB_MIX_INSERT) {
+				h.emplace(key, i), ++z;
+			} else if (c == UDB_MIX_DELETE) {
+				z += h.erase(key);
+			} else {
+				auto p = h.find(key);
+				if (p != h.end()) z += c == UDB_MIX_READ? p->second : ++p->second;
+			}
+			udb_mix_end(c);
 		}
 		udb_measure(n, h.size(), z, &cp[j]);
 	}
 }
+
+#ifndef NO_PARALLEL
+// internal locks with std::mutex; 2**6 submaps like the khashl ensemble
+typedef phmap::parallel_flat_hash_map_m<uint32_t, uint32_t, Hash32, phmap::priv::hash_default_eq<uint32_t>,
+	phmap::priv::Allocator<phmap::priv::Pair<const uint32_t, uint32_t>>, 6> mtmap_t;
+
+static void *worker_int(void *data) // all threads share one table
+{
+	udb_mtarg_t *a = (udb_mtarg_t*)data;
+	mtmap_t &h = *(mtmap_t*)a->h;
+	for (size_t j = 0; j < a->n_key; ++j) {
+		uint32_t key = a->key[j].key, i = a->key[j].i;
+		if (a->is_del) { // toggle under the lock of the submap
+			h.with_submap_m(mtmap_t::subidx(h.hash(key)), [&](mtmap_t::EmbeddedSet &set) {
+				auto p = set.emplace(key, i);
+				if (p.second == false) set.erase(p.first);
+				else ++a->z;
+			});
+		} else {
+			h.lazy_emplace_l(key,
+				[&](mtmap_t::value_type &v) { a->z += ++v.second; },
+				[&](const mtmap_t::constructor &ctor) { ctor(key, 1); ++a->z; });
+		}
+	}
+	return 0;
+}
+
+void test_int_mt(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp, int n_threads)
+{
+	mtmap_t h;
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	udb_mtarg_t *a = udb_mt_init(n_threads, is_del, x0, &h);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, i = n, n += step) {
+		udb_mt_step(a, i, n, UDB_MT_SLICE, worker_int);
+		udb_measure(n, h.size(), udb_mt_checksum(a), &cp[j]);
+	}
+	free(a);
+}
+#endif
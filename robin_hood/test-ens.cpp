@@ -33,6 +33,12 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++h[low][key];
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t sum = 0;
+			for (uint32_t s = 0; s < KH_SUB_N; ++s)
+				for (const auto &p : h[s]) sum += p.second;
+			udb_scan_end(sum);
+		}
 		uint32_t size = 0;
 		for (uint32_t s = 0; s < KH_SUB_N; ++s)
 			size += h[s].size();
@@ -1,3 +1,5 @@
+#define UDB_TEST_LOOKUP
+#define UDB_TEST_MIX
 #include "../common.c"
 #include <functional>
 
@@ -29,6 +31,53 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++h[key];
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			for (const auto &p : h) s += p.second;
+			udb_scan_end(s);
+		}
+		udb_measure(n, h.size(), z, &cp[j]);
+	}
+}
+
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp)
+{
+	robin_hood::unordered_map<uint32_t, uint32_t, Hash32> h;
+	uint64_t z = 0, x = x0;
+	for (uint32_t i = 0; i < N; ++i)
+		h.emplace(udb_build_key(i), i);
+	udb_measure(N, h.size(), 0, &cp[0]);
+	for (uint32_t i = 0; i < n_q; ++i) {
+		auto p = h.find(udb_lookup_key(N, hit, udb_splitmix64(&x)));
+		if (p != h.end()) z += p->second + 1;
+	}
+	udb_measure(n_q, h.size(), z, &cp[1]);
+}
+
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	robin_hood::unordered_map<uint32_t, uint32_t, Hash32> h;
+	uint64_t z = 0, x = x0;
+	uint32_t i = 0;
+	for (; i < n0; ++i)
+		h.emplace(udb_build_key(i), i);
+	udb_measure(0, h.size(), 0, &cp[0]);
+	i = 0;
+	for (uint32_t j = 1; j <= n_cp; ++j) {
+		uint32_t n = (uint64_t)N * j / n_cp;
+		for (; i < n; ++i) {
+			uint32_t key;
+			int c = udb_mix_next(udb_splitmix64(&x), &key);
+			if (c == UDB_MIX_INSERT) {
+				h.emplace(key, i), ++z;
+			} else if (c == UDB_MIX_DELETE) {
+				z += h.erase(key);
+			} else {
+				auto p = h.find(key);
+				if (p != h.end()) z += c == UDB_MIX_READ? p->second : ++p->second;
+			}
+			udb_mix_end(c);
+		}
 		udb_measure(n, h.size(), z, &cp[j]);
 	}
 }
@@ -34,6 +34,12 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				}
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			ptrdiff_t k;
+			for (k = 0; k < hmlen(h); ++k) s += h[k].value;
+			udb_scan_end(s);
+		}
 		udb_measure(n, hmlen(h), z, &cp[j]);
 	}
 	hmfree(h);
@@ -43,6 +43,11 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++r->cnt;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			HASH_ITER(hh, h, r, tmp) s += r->cnt;
+			udb_scan_end(s);
+		}
 		udb_measure(n, n_unique, z, &cp[j]);
 	}
 	HASH_ITER(hh, h, r, tmp) {
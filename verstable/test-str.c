@@ -0,0 +1,34 @@
+#include "../common-str.c"
+
+#define NAME strmap_t
+#define KEY_TY const char *
+#define VAL_TY uint32_t
+#define HASH_FN udb_hash_fn
+#define CMPR_FN udb_str_eq
+#include "verstable.h"
+
+void test_str(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t step = (N - n0) / (n_cp - 1);
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	strmap_t h;
+	strmap_t_init(&h);
+	for (j = 0, i = 0, n = n0; j < n_cp; ++j, n += step) {
+		for (; i < n; ++i) {
+			uint64_t y = udb_splitmix64(&x);
+			const char *key = udb_get_key(n, y);
+			size_t ori_size = strmap_t_size(&h);
+			strmap_t_itr itr = strmap_t_get_or_insert(&h, key, 0);
+			if (is_del) {
+				if (strmap_t_size(&h) == ori_size)
+					strmap_t_erase_itr(&h, itr);
+				else itr.data->val = i, ++z;
+			} else {
+				z += ++itr.data->val;
+			}
+		}
+		udb_measure(n, strmap_t_size(&h), z, &cp[j]);
+	}
+	strmap_t_cleanup(&h);
+}
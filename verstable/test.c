@@ -1,3 +1,5 @@
+#define UDB_TEST_LOOKUP
+#define UDB_TEST_MIX
 #include "../common.c"
 
 #define NAME intmap_t
@@ -30,6 +32,59 @@ void test_int(uint32_t N, uint32_t n0, int32_t is_del, uint32_t x0, uint32_t n_c
 				z += ++itr.data->val;
 			}
 		}
+		if (udb_scan_begin()) {
+			uint64_t s = 0;
+			intmap_t_itr itr;
+			for (itr = intmap_t_first(&h); !intmap_t_is_end(itr); itr = intmap_t_next(itr))
+				s += itr.data->val;
+			udb_scan_end(s);
+		}
+		udb_measure(n, intmap_t_size(&h), z, &cp[j]);
+	}
+	intmap_t_cleanup(&h);
+}
+
+void test_lookup(uint32_t N, uint32_t n_q, uint64_t hit, uint32_t x0, udb_checkpoint_t *cp)
+{
+	uint32_t i;
+	uint64_t z = 0, x = x0;
+	intmap_t h;
+	intmap_t_init(&h);
+	for (i = 0; i < N; ++i)
+		intmap_t_insert(&h, udb_build_key(i), i);
+	udb_measure(N, intmap_t_size(&h), 0, &cp[0]);
+	for (i = 0; i < n_q; ++i) {
+		intmap_t_itr itr = intmap_t_get(&h, udb_lookup_key(N, hit, udb_splitmix64(&x)));
+		if (!intmap_t_is_end(itr)) z += itr.data->val + 1;
+	}
+	udb_measure(n_q, intmap_t_size(&h), z, &cp[1]);
+	intmap_t_cleanup(&h);
+}
+
+void test_mix(uint32_t N, uint32_t n0, uint32_t x0, uint32_t n_cp, udb_checkpoint_t *cp)
+{
+	uint32_t i, n, j;
+	uint64_t z = 0, x = x0;
+	intmap_t h;
+	intmap_t_init(&h);
+	for (i = 0; i < n0; ++i)
+		intmap_t_insert(&h, udb_build_key(i), i);
+	udb_measure(0, intmap_t_size(&h), 0, &cp[0]);
+	for (j = 1, i = 0; j <= n_cp; ++j) {
+		n = (uint64_t)N * j / n_cp;
+		for (; i < n; ++i) {
+			uint32_t key;
+			int c = udb_mix_next(udb_splitmix64(&x), &key);
+			if (c == UDB_MIX_INSERT) {
+				intmap_t_insert(&h, key, i), ++z;
+			} else if (c == UDB_MIX_DELETE) {
+				z += intmap_t_erase(&h, key);
+			} else {
+				intmap_t_itr itr = intmap_t_get(&h, key);
+				if (!intmap_t_is_end(itr)) z += c == UDB_MIX_READ? itr.data->val : ++itr.data->val;
+			}
+			udb_mix_end(c);
+		}
 		udb_measure(n, intmap_t_size(&h), z, &cp[j]);
 	}
 	intmap_t_cleanup(&h);